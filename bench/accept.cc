@@ -0,0 +1,79 @@
+#include <covent.hh>
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// connect and immediately reset connections until told to stop
+void client(std::uint16_t port, std::atomic<bool>& stop) {
+  auto addr = covent::socket_address::ipv4("127.0.0.1", port);
+  linger lin = { 1, 0 };
+
+  while (!stop.load(std::memory_order_relaxed)) {
+    int sock = ::socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(sock, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    connect(sock, &addr.sa, addr.len);
+    close(sock);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::string mode = argc > 1 ? argv[1] : "multishot";
+  std::size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000;
+  unsigned clients = argc > 3 ? std::atoi(argv[3]) : 4;
+  std::uint16_t port = 17777;
+
+  if (mode != "single" && mode != "multishot" && mode != "direct") {
+    std::cerr << "usage: " << argv[0]
+              << " [single|multishot|direct] [count] [clients]" << std::endl;
+    return 1;
+  }
+
+  bool direct = mode == "direct";
+  covent::event_loop loop(std::getenv("COVENT_EVLOOP"), { { "files", 8192 } });
+  std::atomic<bool> stop = false;
+  std::vector<std::thread> threads;
+
+  auto secs = loop.run([&]() -> covent::task<double> {
+    auto acceptor = covent::listen_tcp(
+      covent::socket_address::ipv4("127.0.0.1", port),
+      { .backlog = 4096 }
+    );
+
+    for (unsigned i = 0; i < clients; ++i)
+      threads.emplace_back(client, port, std::ref(stop));
+
+    auto stream = acceptor.accept_stream({ .direct = direct, .buffer = 256 });
+    auto start = std::chrono::steady_clock::now();
+
+    for (std::size_t i = 0; i < count; ++i) {
+      int fd = mode == "single"
+        ? co_await acceptor.accept()
+        : co_await stream.next();
+      if (fd < 0) {
+        std::cerr << "accept failed: " << fd << std::endl;
+        break;
+      }
+      covent::tcp_connection(fd, direct);
+    }
+
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    stop = true;
+    co_return d.count();
+  });
+
+  for (auto& t : threads)
+    t.join();
+
+  std::cout << mode << ": " << count << " connections in " << secs << "s, "
+            << static_cast<std::size_t>(count / secs) << " connections/s"
+            << std::endl;
+  return 0;
+}
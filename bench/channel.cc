@@ -0,0 +1,81 @@
+#include <covent.hh>
+#include <covent/runtime.hh>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// messages per second through a channel, with sender and receiver on
+// the same loop and with senders on loops of their own
+template<typename Channel>
+covent::task<void> produce(Channel& ch, std::size_t count,
+                           std::atomic<unsigned>& left) {
+  for (std::size_t i = 0; i < count; ++i)
+    co_await ch.send(i);
+  if (left.fetch_sub(1) == 1)
+    ch.close();
+}
+
+template<typename Channel>
+covent::task<void> consume(Channel& ch, std::size_t& received) {
+  while (auto msg = co_await ch.recv())
+    ++received;
+}
+
+void report(const std::string& what, std::size_t msgs, double secs) {
+  std::cout << what << ": " << msgs << " messages in " << secs << "s, "
+            << static_cast<std::size_t>(msgs / secs) << " msgs/s, "
+            << secs * 1e9 / msgs << " ns/msg" << std::endl;
+}
+
+template<typename Channel>
+void same_loop(std::size_t count, std::size_t capacity) {
+  covent::event_loop loop(std::getenv("COVENT_EVLOOP"));
+  Channel ch(capacity);
+  std::atomic<unsigned> left = 1;
+  std::size_t received = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  loop.run([&]() {
+    return covent::when_all(produce(ch, count, left), consume(ch, received));
+  });
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  report("1:1 same loop", received, d.count());
+}
+
+template<typename Channel>
+void across_loops(const std::string& what, unsigned producers,
+                  std::size_t count, std::size_t capacity) {
+  covent::runtime rt({
+    { "evloop", static_cast<const char*>(std::getenv("COVENT_EVLOOP")) }
+  }, producers + 1);
+  Channel ch(capacity);
+  std::atomic<unsigned> left = producers;
+  std::size_t received = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  rt.spawn_on(0, [&]() { return consume(ch, received); });
+  for (unsigned i = 1; i <= producers; ++i)
+    rt.spawn_on(i, [&]() { return produce(ch, count, left); });
+  rt.wait();
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  report(what, received, d.count());
+}
+
+int main(int argc, char* argv[]) {
+  std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  unsigned producers = argc > 2 ? std::atoi(argv[2]) : 3;
+  std::size_t capacity = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1024;
+
+  same_loop<covent::spsc_channel<std::size_t>>(count, capacity);
+  across_loops<covent::spsc_channel<std::size_t>>(
+    "1:1 across loops", 1, count, capacity
+  );
+  across_loops<covent::mpsc_channel<std::size_t>>(
+    std::to_string(producers) + ":1 across loops", producers,
+    count, capacity
+  );
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include <covent.hh>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// read the whole file with threads calling pread on a shared offset
+double read_pread(const std::string& path, int flags, std::size_t size,
+                  std::size_t block, unsigned threads) {
+  std::atomic<std::uint64_t> next = 0;
+  std::vector<std::thread> pool;
+  auto start = std::chrono::steady_clock::now();
+
+  for (unsigned i = 0; i < threads; ++i) {
+    pool.emplace_back([&]() {
+      int fd = ::open(path.c_str(), flags);
+      covent::aligned_buffer buf(block);
+      std::uint64_t off;
+      while ((off = next.fetch_add(block)) < size) {
+        if (::pread(fd, buf.data(), block, off) < 0) {
+          std::cerr << "pread failed" << std::endl;
+          break;
+        }
+      }
+      ::close(fd);
+    });
+  }
+
+  for (auto& t : pool)
+    t.join();
+
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+// read the whole file from a single coroutine
+double read_covent(const std::string& path, int flags, std::size_t size,
+                   std::size_t block, unsigned depth) {
+  covent::event_loop loop(std::getenv("COVENT_EVLOOP"));
+  return loop.run([&]() -> covent::task<double> {
+    auto f = std::move(co_await covent::open_file(path, flags));
+    auto start = std::chrono::steady_clock::now();
+
+    covent::file_reader reader(f, block, depth);
+    std::size_t total = 0;
+    while (true) {
+      auto data = co_await reader.next();
+      if (data.empty())
+        break;
+      total += data.size();
+    }
+
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    if (total != size)
+      std::cerr << "short read: " << total << " of " << size << std::endl;
+    co_return d.count();
+  });
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0]
+              << " path [size MiB] [block KiB] [depth/threads] [direct]"
+              << std::endl;
+    return 1;
+  }
+
+  std::string path = argv[1];
+  std::size_t size = (argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1024) << 20;
+  std::size_t block = (argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 128) << 10;
+  unsigned depth = argc > 4 ? std::atoi(argv[4]) : 8;
+  bool direct = argc > 5 && std::string(argv[5]) == "direct";
+
+  // Create the test file if it's too small. Without O_DIRECT both
+  // sides mostly measure copying out of the page cache.
+  if (int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644); fd >= 0) {
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) < size) {
+      std::vector<char> chunk(1 << 20, 'x');
+      for (std::size_t off = 0; off < size; off += chunk.size())
+        if (::pwrite(fd, chunk.data(), chunk.size(), off) < 0)
+          return 1;
+      ::fsync(fd);
+    }
+    ::close(fd);
+  }
+
+  int flags = O_RDONLY | O_CLOEXEC | (direct ? O_DIRECT : 0);
+  double mib = static_cast<double>(size >> 20);
+
+  auto secs = read_covent(path, flags, size, block, depth);
+  std::cout << "file_reader depth " << depth << ": "
+            << mib / secs << " MiB/s" << std::endl;
+
+  secs = read_pread(path, flags, size, block, depth);
+  std::cout << "pread " << depth << " threads: "
+            << mib / secs << " MiB/s" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,52 @@
+#include <covent.hh>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+// Cost of the suspend path: awaiting a timer that already expired goes
+// through await_transform, creating the event awaiter, suspending,
+// running the loop and resuming without a system call for the timer
+// itself. With a cancelled token it is skipped, leaving creating and
+// destroying the awaiter. Compare builds with and without
+// COVENT_STATIC_EVLOOP.
+covent::task<double> measure(std::size_t count, bool skip) {
+  covent::cancellation_token token;
+  if (skip)
+    token.cancel();
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (std::size_t i = 0; i < count; ++i)
+    co_await covent::with_cancel(token, std::chrono::steady_clock::time_point());
+
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  co_return d.count();
+}
+
+constexpr const char* build =
+  std::is_same_v<covent::detail::loop_type, covent::detail::evloop_base>
+    ? "virtual" : "direct";
+
+void report(const std::string& what, std::size_t ops, double secs) {
+  std::cout << what << ": " << ops << " suspensions in " << secs << "s, "
+            << static_cast<std::size_t>(ops / secs) << " ops/s, "
+            << secs * 1e9 / ops << " ns/op" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+  covent::event_loop loop(std::getenv("COVENT_EVLOOP"), { { "frame_pool", true } });
+
+  // warm up the frame pool and caches
+  loop.run([&]() { return measure(count / 10, false); });
+
+  report(std::string("expired timer (") + build + ")", count,
+         loop.run([&]() { return measure(count, false); }));
+  report(std::string("skipped timer (") + build + ")", count,
+         loop.run([&]() { return measure(count, true); }));
+  return 0;
+}
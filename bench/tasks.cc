@@ -0,0 +1,65 @@
+#include <covent.hh>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// cost of creating, awaiting and destroying a task that completes
+// without suspending, with atomic and with single threaded bookkeeping
+template<template<typename> typename Task>
+Task<std::size_t> leaf(std::size_t i) {
+  co_return i;
+}
+
+template<template<typename> typename Task>
+Task<std::size_t> nested(std::size_t depth, std::size_t i) {
+  if (depth == 0)
+    co_return i;
+  co_return co_await nested<Task>(depth - 1, i) + 1;
+}
+
+template<template<typename> typename Task>
+covent::task<double> measure(std::size_t count, std::size_t depth) {
+  std::size_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for (std::size_t i = 0; i < count; ++i) {
+    if (depth == 0)
+      sum += co_await leaf<Task>(i);
+    else
+      sum += co_await nested<Task>(depth, i);
+  }
+
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  if (sum == 0 && count > 1)
+    std::cerr << "unexpected sum" << std::endl;
+  co_return d.count();
+}
+
+void report(const std::string& what, std::size_t ops, double secs) {
+  std::cout << what << ": " << ops << " tasks in " << secs << "s, "
+            << static_cast<std::size_t>(ops / secs) << " tasks/s, "
+            << secs * 1e9 / ops << " ns/task" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+  std::size_t depth = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 0;
+  bool pooled = argc > 3 && std::string(argv[3]) == "pool";
+
+  covent::event_loop loop(std::getenv("COVENT_EVLOOP"), { { "frame_pool", pooled } });
+  auto ops = count * (depth + 1);
+
+  auto run = [&]<template<typename> typename Task>(std::size_t n) {
+    return loop.run([&]() { return measure<Task>(n, depth); });
+  };
+
+  // warm up the frame pool and caches for both
+  run.operator()<covent::task>(count / 10);
+  run.operator()<covent::local_task>(count / 10);
+
+  report("task", ops, run.operator()<covent::task>(count));
+  report("local_task", ops, run.operator()<covent::local_task>(count));
+  return 0;
+}
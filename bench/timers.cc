@@ -0,0 +1,70 @@
+#include "timers.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+using covent::detail::timer_clock;
+
+struct bench_timer : public covent::detail::timer_node {
+  static inline std::size_t fired = 0;
+
+  void expire() {
+    ++fired;
+  }
+};
+
+template<typename Func>
+void measure(const std::string& what, std::size_t ops, Func func) {
+  auto start = std::chrono::steady_clock::now();
+  func();
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+  std::cout << what << ": " << ops << " ops in " << secs.count() << "s, "
+            << static_cast<std::size_t>(ops / secs.count()) << " ops/s"
+            << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  auto slack = std::chrono::nanoseconds(argc > 2 ? std::atol(argv[2]) : 0);
+
+  covent::detail::timer_heap heap(slack);
+  std::vector<bench_timer> timers(count);
+  std::vector<timer_clock::time_point> deadlines(count);
+
+  std::mt19937_64 rng(42);
+  std::uniform_int_distribution<long> dist(0, 1000000000);
+  auto base = timer_clock::now();
+  for (auto& d : deadlines)
+    d = base + std::chrono::nanoseconds(dist(rng));
+
+  measure("arm", count, [&]() {
+    for (std::size_t i = 0; i < count; ++i)
+      heap.arm(&timers[i], deadlines[i]);
+  });
+
+  measure("cancel", count / 2, [&]() {
+    for (std::size_t i = 0; i < count; i += 2)
+      heap.cancel(&timers[i]);
+  });
+
+  measure("re-arm", count / 2, [&]() {
+    for (std::size_t i = 0; i < count; i += 2)
+      heap.arm(&timers[i], deadlines[i]);
+  });
+
+  measure("fire", count, [&]() {
+    heap.expire(base + 2s);
+  });
+
+  if (bench_timer::fired != count) {
+    std::cerr << "fired " << bench_timer::fired << " of " << count << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
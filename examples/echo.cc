@@ -0,0 +1,28 @@
+#include <covent.hh>
+#include <iostream>
+
+int main() {
+  return covent::run([]() -> covent::task<int> {
+    auto acceptor = covent::listen_tcp(7777, { .backlog = 1024 });
+    std::cout << ">>> listening on port 7777" << std::endl;
+
+    while (true) {
+      int fd = co_await acceptor.accept();
+      if (fd < 0)
+        co_return 1;
+
+      covent::tcp_connection conn(fd);
+      char buf[4096];
+
+      // echo what was received and wait for more with a single
+      // round trip through the loop
+      int len = co_await conn.recv(buf, sizeof(buf));
+      while (len > 0) {
+        auto [sent, received] = co_await covent::chain(
+          conn.send(buf, len), conn.recv(buf, sizeof(buf))
+        );
+        len = sent < 0 ? sent : received;
+      }
+    }
+  });
+}
@@ -0,0 +1,40 @@
+#include <covent.hh>
+#include <covent/runtime.hh>
+#include <iostream>
+
+covent::task<void> echo(covent::tcp_connection conn) {
+  char buf[4096];
+  int len = co_await conn.recv(buf, sizeof(buf));
+  while (len > 0) {
+    auto [sent, received] = co_await covent::chain(
+      conn.send(buf, len), conn.recv(buf, sizeof(buf))
+    );
+    len = sent < 0 ? sent : received;
+  }
+}
+
+int main() {
+  covent::runtime rt;
+  std::cout << ">>> listening on port 7777 with "
+            << rt.size() << " loops" << std::endl;
+
+  // every loop accepts on its own socket and serves the connections it
+  // accepted; the kernel balances connections between the sockets
+  for (std::size_t i = 0; i < rt.size(); ++i) {
+    rt.spawn_on(i, [&rt, i]() -> covent::task<void> {
+      auto acceptor = covent::listen_tcp(
+        7777, { .backlog = 1024, .reuseport = true }
+      );
+      auto connections = acceptor.accept_stream();
+
+      while (true) {
+        int fd = co_await connections.next();
+        if (fd < 0)
+          break;
+        rt.spawn_on(i, echo, covent::tcp_connection(fd));
+      }
+    });
+  }
+
+  rt.wait();
+}
@@ -5,13 +5,6 @@
 
 using namespace std::chrono_literals;
 
-namespace covent {
-  class task_group {
-    public:
-      
-  };
-}
-
 covent::task<> sleeper(int n) {
   std::cout << ">>> sleeper n=" << n << " starting" << std::endl;
   co_await (3s - std::chrono::seconds { n });
@@ -22,14 +15,20 @@ int main() {
   auto i = covent::run([]() -> covent::task<int> {
     std::cout << ">>> main starting" << std::endl;
 
-    auto t1 = sleeper(1);
-    auto t2 = sleeper(2);
+    covent::task_group group;
+    group.spawn(sleeper(1));
+    group.spawn(sleeper(2));
+    co_await group.wait();
+
+    co_await covent::when_all(sleeper(0), sleeper(1));
 
-    // covent::task_group { t1, t2 };
+    // the slower one gets cancelled
+    auto first = co_await covent::when_any(sleeper(1), sleeper(2));
+    std::cout << ">>> first=" << first << std::endl;
 
     std::cout << ">>> main ending" << std::endl;
     co_return 42;
   });
-  std::cout << "i=" << 42 << std::endl;
+  std::cout << "i=" << i << std::endl;
   return 0;
 }
@@ -13,4 +13,10 @@
  * limitations under the License.
  */
 
+#include <covent/channel.hh>
 #include <covent/event_loop.hh>
+#include <covent/file.hh>
+#include <covent/generator.hh>
+#include <covent/net.hh>
+#include <covent/sync.hh>
+#include <covent/taskgrp.hh>
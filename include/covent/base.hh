@@ -15,21 +15,139 @@
 #ifndef COVENT_BASE_HH
 #define COVENT_BASE_HH
 
+#include <any>
 #include <coroutine>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+
+#include <covent/buffers.hh>
+#include <covent/ops.hh>
+#include <covent/stream.hh>
+#include <covent/time.hh>
+
+namespace covent {
+
+  class event_loop_config {
+    protected:
+      std::map<std::string, std::any> values;
+
+    public:
+      event_loop_config(std::initializer_list<decltype(values)::value_type>&& v)
+        : values(std::forward<decltype(v)>(v)) {
+        /* nothing to do here */
+      }
+
+      template<typename T, typename C = T>
+        requires std::is_convertible_v<T, C>
+      T get(std::string&& key, T&& def) const {
+        if (auto item = values.find(key); item != values.end())
+          return static_cast<C>(std::any_cast<T>(item->second));
+        return def;
+      }
+  };
+
+  // counters describing the work an event loop has been doing
+  struct event_loop_stats {
+    // event awaiters constructed in their inline storage
+    std::uint64_t awaiters_inline = 0;
+    // event awaiters too large for inline storage and heap allocated
+    std::uint64_t awaiters_heap = 0;
+    // coroutine frames reused from the frame pool free lists
+    std::uint64_t frames_pooled = 0;
+    // coroutine frames freshly allocated for a frame pool size class
+    std::uint64_t frames_allocated = 0;
+    // coroutine frames too large for the frame pool
+    std::uint64_t frames_fallback = 0;
+    // coroutine frames destroyed away from the loop and handed back
+    std::uint64_t frames_returned = 0;
+    // submission queue found full and flushed to make room
+    std::uint64_t sq_full = 0;
+    // awaiters queued up because flushing didn't make room
+    std::uint64_t sq_backlogged = 0;
+    // completions arriving for awaiters that were already destroyed
+    std::uint64_t completions_dropped = 0;
+    // posted work given up on because the target loop couldn't be
+    // reached for good
+    std::uint64_t messages_dropped = 0;
+    // coroutines resumed from the ready queue
+    std::uint64_t ready_resumed = 0;
+    // calls to run_once leaving queued coroutines for the next one
+    std::uint64_t ready_deferred = 0;
+  };
+
+}
 
 namespace covent::detail {
 
   // forward declarations of implementation interfaces
   class event_awaiter_impl;
+  class evloop_base;
+  class frame_pool;
+
+  // Work handed to a loop, possibly from another thread. run() is
+  // called on the thread of the target loop and takes care of the
+  // lifetime of the work item.
+  class posted_work {
+    public:
+      evloop_base* target = nullptr;
+
+      // link for loops queueing work up in memory
+      posted_work* posted_next = nullptr;
+
+      virtual ~posted_work() = default;
+      virtual void run() = 0;
+  };
+
+  // Cell pointing back at a loop until it is destroyed, for objects
+  // that may outlive it. The loop clears it under the lock before
+  // tearing anything down, so holding the lock keeps it alive.
+  struct loop_handle {
+      std::mutex lock;
+      evloop_base* loop;
+  };
+
+  // Intrusive list node of a coroutine waiting to be resumed. Nodes
+  // of the ready queue may carry a callback to run instead.
+  struct waiter_list {
+      std::coroutine_handle<> continuation;
+      waiter_list* next;
+      void (*callback)(waiter_list*) = nullptr;
+  };
+
+  // Awaiters resuming the awaiting coroutine on another thread derive
+  // from this, so tasks pick up the loop they continue on.
+  class loop_hop {
+    /* nothing to do here */
+  };
 
   // ...
   class event_awaiter {
+    public:
+      // size of the inline storage; large enough for all awaiters of
+      // the bundled event loop implementations
+      static constexpr std::size_t storage_size = 128;
+
     protected:
+      alignas(std::max_align_t) std::byte storage[storage_size];
       event_awaiter_impl* impl;
 
+      friend class evloop_base;
+
+      bool is_inline() const noexcept {
+        auto p = reinterpret_cast<const std::byte*>(impl);
+        return p >= storage && p < storage + storage_size;
+      }
+
     public:
-      event_awaiter(event_awaiter_impl*);
+      template<typename ImplType, typename ...Args>
+      event_awaiter(evloop_base&, std::in_place_type_t<ImplType>, Args&&...);
       ~event_awaiter();
 
       // not copyable
@@ -38,21 +156,218 @@ namespace covent::detail {
 
       bool await_ready();
       void await_suspend(std::coroutine_handle<>);
-      void await_resume();
+      int await_resume();
+
+      void start();
+      void cancel();
+      void set_timeout(std::chrono::nanoseconds);
+  };
+
+  // Awaiter of an event loop implementation known at compile time,
+  // held by value in place of an event_awaiter so calls into it are
+  // direct and can be inlined.
+  template<typename ImplType>
+  class direct_awaiter {
+    protected:
+      ImplType impl;
+
+    public:
+      template<typename ...Args>
+      direct_awaiter(std::in_place_t, Args&& ...args)
+        : impl(std::forward<Args>(args)...) {
+        /* nothing to do here */
+      }
+
+      // not copyable
+      direct_awaiter(const direct_awaiter&) = delete;
+      direct_awaiter& operator=(const direct_awaiter&) = delete;
+
+      bool await_ready() {
+        return impl.await_ready();
+      }
+
+      void await_suspend(std::coroutine_handle<> c) {
+        impl.parent = c;
+        impl.await_suspend();
+      }
+
+      int await_resume() {
+        return impl.await_resume();
+      }
+
+      void start() {
+        impl.start();
+      }
+
+      void cancel() {
+        impl.cancel();
+      }
+
+      void set_timeout(std::chrono::nanoseconds ns) {
+        impl.set_timeout(ns);
+      }
   };
 
 
   // ...
   class evloop_base {
+    friend class event_awaiter;
+    friend void* allocate_frame(std::size_t);
+    friend void deallocate_frame(void*, std::size_t) noexcept;
+
+    protected:
+      event_loop_stats stats;
+      frame_pool* frames = nullptr;
+
+      // FIFO of coroutines to resume from run_once, linked through
+      // nodes living in the frames of the waiting coroutines
+      waiter_list* ready_head = nullptr;
+      waiter_list** ready_tail = &ready_head;
+      unsigned ready_budget;
+
+      std::shared_ptr<loop_handle> self;
+
+      evloop_base(const event_loop_config&);
+
+      // clear the handle; first thing implementations do on destruction
+      void retire() noexcept;
+
+      // Resume queued coroutines, at most ready_budget of them so a
+      // burst of wake ups can't starve the ring. Coroutines queued in
+      // the meantime wait for the next call. Returns the number of
+      // resumed coroutines; with any, the loop may be done already and
+      // must not wait for events.
+      unsigned run_ready();
+
+      bool has_ready() const noexcept {
+        return ready_head != nullptr;
+      }
+
+      static event_awaiter_impl* impl_of(event_awaiter& aw) noexcept {
+        return aw.impl;
+      }
+
     public:
+      virtual ~evloop_base();
+
       virtual void run_once() = 0;
       virtual event_awaiter create_event_awaiter(std::chrono::nanoseconds&&) = 0;
+      virtual event_awaiter create_event_awaiter(std::chrono::steady_clock::time_point&&) = 0;
+      virtual event_awaiter create_event_awaiter(std::chrono::system_clock::time_point&&) = 0;
+      virtual event_awaiter create_event_awaiter(boot_clock::time_point&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::accept&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::connect&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::recv&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::send&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::sendmsg&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::writev&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::read&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::write&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::openat&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::fsync&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::fallocate&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::statx&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::close&&) = 0;
+      virtual event_awaiter create_event_awaiter(op::shutdown&&) = 0;
+
+      virtual event_stream<int> create_event_stream(op::multishot_accept&&) = 0;
+      virtual event_stream<buffer_view> create_event_stream(op::recv_multishot&&) = 0;
+      virtual event_stream<int> create_event_stream(op::poll_multishot&&) = 0;
+
+      // Submit the awaiters as a chain of linked operations, each one
+      // started once the previous one succeeded, or completed with
+      // hard set. Resumes the coroutine once all of them completed.
+      virtual void submit_chain(event_awaiter*, std::size_t, bool,
+                                std::coroutine_handle<>) = 0;
+
+      // Hand work to this loop; safe to call from any thread. Threads
+      // not running a loop get a std::system_error if the loop can't be
+      // reached, in which case they keep the work item.
+      virtual void post(posted_work*) = 0;
+
+      // kernel managed group of equally sized receive buffers
+      virtual buffer_group_impl* create_buffer_group(unsigned, std::size_t) = 0;
+
+      // Registry of the fixed file and buffer tables: install a file
+      // descriptor, respectively a range of buffers, and return its
+      // index, throwing if the table is full.
+      virtual int register_file(int) = 0;
+      virtual void unregister_file(int) = 0;
+      virtual int register_buffers(const iovec*, unsigned) = 0;
+      virtual void unregister_buffers(int, unsigned) = 0;
+
+      // release an entry of the fixed file table
+      virtual void close_fixed(int) = 0;
+
+      // queue a coroutine to be resumed by the loop; thread of the
+      // loop only
+      void schedule(waiter_list* w) noexcept {
+        w->next = nullptr;
+        *ready_tail = w;
+        ready_tail = &w->next;
+      }
+
+      // take a node off the ready queue again; thread of the loop only
+      void unschedule(waiter_list* w) noexcept {
+        for (auto p = &ready_head; *p != nullptr; p = &(*p)->next) {
+          if (*p == w) {
+            *p = w->next;
+            if (ready_tail == &w->next)
+              ready_tail = p;
+            return;
+          }
+        }
+      }
+
+      const event_loop_stats& get_stats() const noexcept {
+        return stats;
+      }
+
+      // for objects holding on to entries of the tables of the loop
+      std::shared_ptr<loop_handle> handle() const noexcept {
+        return self;
+      }
+  };
+
+  // construct the awaiter implementation in place if it fits the
+  // inline storage, otherwise fall back to the heap
+  template<typename ImplType, typename ...Args>
+  event_awaiter::event_awaiter(evloop_base& loop,
+                               std::in_place_type_t<ImplType>,
+                               Args&& ...args) {
+    if constexpr (sizeof(ImplType) <= storage_size &&
+                  alignof(ImplType) <= alignof(std::max_align_t)) {
+      impl = new (storage) ImplType(std::forward<Args>(args)...);
+      ++loop.stats.awaiters_inline;
+    }
+    else {
+      impl = new ImplType(std::forward<Args>(args)...);
+      ++loop.stats.awaiters_heap;
+    }
+  }
+
+  // Creates the awaiters of events on loops of type Loop, through the
+  // virtual interface unless an implementation specializes it to
+  // construct its awaiters directly.
+  template<typename Loop>
+  struct awaiter_factory {
+      template<typename ...Args>
+      static event_awaiter create(evloop_base& loop, Args&& ...args) {
+        return loop.create_event_awaiter(std::forward<Args>(args)...);
+      }
   };
 
   // ...
   void set_active_loop(evloop_base*);
   evloop_base& get_active_loop();
 
+  // nullptr on threads not running a loop
+  evloop_base* find_active_loop() noexcept;
+
+  // allocate coroutine frames from the frame pool of the active loop
+  void* allocate_frame(std::size_t);
+  void deallocate_frame(void*, std::size_t) noexcept;
+
 }
 
 #endif
@@ -0,0 +1,220 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_BUFFERS_HH
+#define COVENT_BUFFERS_HH
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+
+namespace covent {
+
+  struct buffer_group_stats {
+    // buffers picked by the kernel for received data
+    std::uint64_t handed_out = 0;
+    // buffers given back to the kernel
+    std::uint64_t recycled = 0;
+    // receives that found the group empty (-ENOBUFS)
+    std::uint64_t exhausted = 0;
+    // time between handing buffers out and getting them back
+    std::chrono::nanoseconds recycle_total = {};
+    std::chrono::nanoseconds recycle_max = {};
+  };
+
+}
+
+namespace covent::detail {
+
+  // Group of equally sized buffers the kernel picks from when data
+  // arrives. Stays alive until both its handle and all buffers handed
+  // out are gone.
+  class buffer_group_impl {
+    public:
+      using clock = std::chrono::steady_clock;
+
+    protected:
+      buffer_group_stats stats;
+      std::size_t outstanding = 0;
+      bool orphaned = false;
+
+      // make a buffer available to the kernel again
+      virtual void release(std::uint16_t) = 0;
+
+    public:
+      virtual ~buffer_group_impl() = default;
+
+      virtual std::byte* data(std::uint16_t) noexcept = 0;
+
+      void hand_out() noexcept {
+        ++outstanding;
+        ++stats.handed_out;
+      }
+
+      void exhausted() noexcept {
+        ++stats.exhausted;
+      }
+
+      void recycle(std::uint16_t id, clock::time_point since) {
+        auto held = clock::now() - since;
+        release(id);
+        ++stats.recycled;
+        stats.recycle_total += held;
+        if (held > stats.recycle_max)
+          stats.recycle_max = held;
+        if (--outstanding == 0 && orphaned)
+          delete this;
+      }
+
+      // keep the group around while the kernel may still pick buffers
+      // from it for an operation nobody waits for anymore
+      void pin() noexcept {
+        ++outstanding;
+      }
+
+      void unpin() noexcept {
+        if (--outstanding == 0 && orphaned)
+          delete this;
+      }
+
+      void orphan() noexcept {
+        orphaned = true;
+        if (outstanding == 0)
+          delete this;
+      }
+
+      const buffer_group_stats& get_stats() const noexcept {
+        return stats;
+      }
+  };
+
+}
+
+namespace covent {
+
+  // A buffer of a buffer group filled with received data. It is
+  // returned to the group on destruction, so hold on to it only as long
+  // as necessary. An empty view carries the result of the receive
+  // instead: zero at the end of the stream or a negated errno value.
+  class buffer_view {
+    protected:
+      using clock = detail::buffer_group_impl::clock;
+
+      detail::buffer_group_impl* group = nullptr;
+      std::uint16_t id = 0;
+      int res = 0;
+      clock::time_point since;
+
+    public:
+      buffer_view() noexcept = default;
+
+      explicit buffer_view(int r) noexcept : res(r) {
+        /* nothing to do here */
+      }
+
+      buffer_view(detail::buffer_group_impl* g, std::uint16_t i, int r)
+        : group(g), id(i), res(r), since(clock::now()) {
+        group->hand_out();
+      }
+
+      buffer_view(buffer_view&& other) noexcept
+        : group(std::exchange(other.group, nullptr)),
+          id(other.id), res(other.res), since(other.since) {
+        /* nothing to do here */
+      }
+
+      buffer_view& operator=(buffer_view&& other) noexcept {
+        if (&other != this) {
+          reset();
+          group = std::exchange(other.group, nullptr);
+          id = other.id;
+          res = other.res;
+          since = other.since;
+        }
+        return *this;
+      }
+
+      ~buffer_view() {
+        reset();
+      }
+
+      // not copyable
+      buffer_view(const buffer_view&) = delete;
+      buffer_view& operator=(const buffer_view&) = delete;
+
+      // give the buffer back early
+      void reset() {
+        if (group != nullptr)
+          std::exchange(group, nullptr)->recycle(id, since);
+      }
+
+      // number of bytes received or a negated errno value
+      int result() const noexcept {
+        return res;
+      }
+
+      explicit operator bool() const noexcept {
+        return group != nullptr;
+      }
+
+      const std::byte* data() const noexcept {
+        return group != nullptr ? group->data(id) : nullptr;
+      }
+
+      std::size_t size() const noexcept {
+        return group != nullptr ? static_cast<std::size_t>(res) : 0;
+      }
+
+      std::span<const std::byte> bytes() const noexcept {
+        return { data(), size() };
+      }
+  };
+
+  // Handle to a buffer group of the active loop: count buffers of size
+  // bytes each, count being a power of two.
+  class buffer_group {
+    protected:
+      detail::buffer_group_impl* impl;
+
+    public:
+      buffer_group(unsigned count, std::size_t size);
+
+      buffer_group(buffer_group&& other) noexcept
+        : impl(std::exchange(other.impl, nullptr)) {
+        /* nothing to do here */
+      }
+
+      ~buffer_group() {
+        if (impl != nullptr)
+          impl->orphan();
+      }
+
+      // not copyable
+      buffer_group(const buffer_group&) = delete;
+      buffer_group& operator=(const buffer_group&) = delete;
+
+      detail::buffer_group_impl* get() const noexcept {
+        return impl;
+      }
+
+      const buffer_group_stats& stats() const noexcept {
+        return impl->get_stats();
+      }
+  };
+
+}
+
+#endif
@@ -0,0 +1,218 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_CANCEL_HH
+#define COVENT_CANCEL_HH
+
+#include <covent/base.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <type_traits>
+#include <utility>
+
+namespace covent {
+
+  class cancellation_token;
+
+}
+
+namespace covent::detail {
+
+  // notified when a token gets cancelled while something other than an
+  // event is awaited with it
+  class cancel_listener {
+    public:
+      virtual void on_cancel() = 0;
+
+    protected:
+      ~cancel_listener() = default;
+  };
+
+  // event together with the options it is to be awaited with
+  template<typename Op>
+  struct op_request {
+      Op op;
+      cancellation_token* token = nullptr;
+      std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max();
+  };
+
+  template<typename Op>
+  struct make_request {
+      using type = op_request<std::decay_t<Op>>;
+      static type from(Op&& op) {
+        return { std::forward<Op>(op) };
+      }
+  };
+
+  template<typename Op>
+  struct make_request<op_request<Op>> {
+      using type = op_request<Op>;
+      static type from(op_request<Op>&& req) {
+        return std::move(req);
+      }
+  };
+
+  // Event awaiter applying the options of an op_request; an
+  // event_awaiter or, with an implementation known at compile time, a
+  // direct_awaiter.
+  template<typename Awaiter>
+  class request_awaiter {
+    protected:
+      Awaiter aw;
+      cancellation_token* token;
+      std::chrono::nanoseconds timeout;
+      bool skipped = false;
+
+    public:
+      template<typename Factory>
+      request_awaiter(Factory&& create,
+                      cancellation_token* t,
+                      std::chrono::nanoseconds to)
+        : aw(create()), token(t), timeout(to) {
+        /* nothing to do here */
+      }
+
+      ~request_awaiter();
+
+      // not copyable
+      request_awaiter(const request_awaiter&) = delete;
+      request_awaiter& operator=(const request_awaiter&) = delete;
+
+      bool await_ready();
+      void await_suspend(std::coroutine_handle<>);
+      int await_resume();
+  };
+
+  template<typename Factory>
+  request_awaiter(Factory&&, cancellation_token*, std::chrono::nanoseconds)
+    -> request_awaiter<std::invoke_result_t<Factory&>>;
+
+}
+
+namespace covent {
+
+  // Cancels the event awaited with it. Once cancelled, all further
+  // events awaited with the token complete with -ECANCELED right away
+  // until it is reset.
+  class cancellation_token {
+    template<typename> friend class detail::request_awaiter;
+
+    protected:
+      // awaiter of the event awaited with the token and how to cancel it
+      void* pending = nullptr;
+      void (*cancel_pending)(void*) = nullptr;
+      bool requested = false;
+      detail::cancel_listener* listener = nullptr;
+
+    public:
+      cancellation_token() noexcept = default;
+
+      // not copyable
+      cancellation_token(const cancellation_token&) = delete;
+      cancellation_token& operator=(const cancellation_token&) = delete;
+
+      void cancel() {
+        requested = true;
+        if (pending != nullptr)
+          cancel_pending(pending);
+        else if (listener != nullptr)
+          listener->on_cancel();
+      }
+
+      bool cancelled() const noexcept {
+        return requested;
+      }
+
+      void reset() noexcept {
+        requested = false;
+      }
+
+      // pass cancellation on while not awaiting an event; nullptr to
+      // stop doing so
+      void listen(detail::cancel_listener* l) noexcept {
+        listener = l;
+      }
+
+      detail::cancel_listener* listening() const noexcept {
+        return listener;
+      }
+  };
+
+  // await an event so that it can be cancelled through the token
+  template<typename Op>
+  auto with_cancel(cancellation_token& token, Op&& op) {
+    auto req = detail::make_request<std::decay_t<Op>>::from(
+      std::decay_t<Op>(std::forward<Op>(op))
+    );
+    req.token = &token;
+    return req;
+  }
+
+  // await an event for at most the given time; it completes with -ETIME
+  // if it didn't complete before
+  template<typename Op, typename Rep, typename Period>
+  auto with_timeout(Op&& op, std::chrono::duration<Rep, Period> timeout) {
+    auto req = detail::make_request<std::decay_t<Op>>::from(
+      std::decay_t<Op>(std::forward<Op>(op))
+    );
+    req.timeout = std::min(
+      req.timeout,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(timeout)
+    );
+    return req;
+  }
+
+}
+
+namespace covent::detail {
+
+  template<typename Awaiter>
+  request_awaiter<Awaiter>::~request_awaiter() {
+    if (token != nullptr && token->pending == &aw)
+      token->pending = nullptr;
+  }
+
+  template<typename Awaiter>
+  bool request_awaiter<Awaiter>::await_ready() {
+    // skip events awaited with an already cancelled token
+    skipped = token != nullptr && token->requested;
+    return skipped || aw.await_ready();
+  }
+
+  template<typename Awaiter>
+  void request_awaiter<Awaiter>::await_suspend(std::coroutine_handle<> c) {
+    if (timeout != std::chrono::nanoseconds::max())
+      aw.set_timeout(timeout);
+    if (token != nullptr) {
+      token->pending = &aw;
+      token->cancel_pending = [](void* p) {
+        static_cast<Awaiter*>(p)->cancel();
+      };
+    }
+    aw.await_suspend(c);
+  }
+
+  template<typename Awaiter>
+  int request_awaiter<Awaiter>::await_resume() {
+    if (token != nullptr)
+      token->pending = nullptr;
+    return skipped ? -ECANCELED : aw.await_resume();
+  }
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_CHAIN_HH
+#define COVENT_CHAIN_HH
+
+#include <covent/base.hh>
+
+#include <array>
+#include <concepts>
+#include <coroutine>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace covent::detail {
+
+  // Single shot operations, which every loop implements in a way that
+  // can be linked to others; sleeps and streams can't be chained.
+  template<typename Op>
+  concept chainable =
+    std::same_as<Op, op::accept> || std::same_as<Op, op::connect> ||
+    std::same_as<Op, op::recv> || std::same_as<Op, op::send> ||
+    std::same_as<Op, op::sendmsg> || std::same_as<Op, op::writev> ||
+    std::same_as<Op, op::read> || std::same_as<Op, op::write> ||
+    std::same_as<Op, op::openat> || std::same_as<Op, op::fsync> ||
+    std::same_as<Op, op::fallocate> || std::same_as<Op, op::statx> ||
+    std::same_as<Op, op::close> || std::same_as<Op, op::shutdown>;
+
+  template<chainable ...Ops>
+  struct op_chain {
+      std::tuple<Ops...> ops;
+      bool hard;
+  };
+
+  template<std::size_t N>
+  class chain_awaiter {
+    protected:
+      evloop_base& loop;
+      std::array<event_awaiter, N> aws;
+      bool hard;
+
+    public:
+      template<typename Factory>
+      chain_awaiter(evloop_base& l, Factory&& create, bool h)
+        : loop(l), aws(create()), hard(h) {
+        /* nothing to do here */
+      }
+
+      // not copyable
+      chain_awaiter(const chain_awaiter&) = delete;
+      chain_awaiter& operator=(const chain_awaiter&) = delete;
+
+      bool await_ready() const noexcept {
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> c) {
+        loop.submit_chain(aws.data(), N, hard, c);
+      }
+
+      std::array<int, N> await_resume() {
+        std::array<int, N> res;
+        for (std::size_t i = 0; i < N; ++i)
+          res[i] = aws[i].await_resume();
+        return res;
+      }
+  };
+
+}
+
+namespace covent {
+
+  // Operations submitted at once as linked SQEs, each one started once
+  // the previous one succeeded. The awaiting coroutine is resumed a
+  // single time with the results of all of them; those after a failed
+  // one are -ECANCELED.
+  template<typename ...Ops>
+  requires (detail::chainable<std::decay_t<Ops>> && ...)
+  detail::op_chain<std::decay_t<Ops>...> chain(Ops&& ...ops) {
+    return { { std::forward<Ops>(ops)... }, false };
+  }
+
+  // same, but following operations are started even if one failed
+  template<typename ...Ops>
+  requires (detail::chainable<std::decay_t<Ops>> && ...)
+  detail::op_chain<std::decay_t<Ops>...> hard_chain(Ops&& ...ops) {
+    return { { std::forward<Ops>(ops)... }, true };
+  }
+
+}
+
+#endif
@@ -0,0 +1,443 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_CHANNEL_HH
+#define COVENT_CHANNEL_HH
+
+#include <covent/base.hh>
+#include <covent/parking.hh>
+
+#include <atomic>
+#include <bit>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace covent::detail {
+
+  inline constexpr std::size_t cache_line = 64;
+
+  // Keeps the members before and after it on different cache lines, so
+  // indices written by producers and consumers don't share one. Padding
+  // rather than alignas: channels live in coroutine frames, which don't
+  // honor alignment beyond that of operator new.
+  struct cache_line_pad {
+      std::byte bytes[cache_line];
+  };
+
+  template<typename T>
+  class ring_slot {
+    protected:
+      alignas(T) std::byte storage[sizeof(T)];
+
+    public:
+      template<typename V>
+      void put(V&& v) noexcept ( std::is_nothrow_constructible_v<T, V&&> ) {
+        new (storage) T(std::forward<V>(v));
+      }
+
+      T take() noexcept ( std::is_nothrow_move_constructible_v<T> ) {
+        auto p = std::launder(reinterpret_cast<T*>(storage));
+        T v(std::move(*p));
+        p->~T();
+        return v;
+      }
+  };
+
+  // Lamport ring for a single producer and a single consumer. Both
+  // sides keep a copy of the index of the other side and only reload
+  // it once they seem to run out of items or space.
+  template<typename T>
+  class spsc_ring {
+    protected:
+      std::size_t mask;
+      std::unique_ptr<ring_slot<T>[]> slots;
+
+      cache_line_pad pad0;
+      std::atomic<std::size_t> head = 0;
+      std::size_t tail_cache = 0;
+
+      cache_line_pad pad1;
+      std::atomic<std::size_t> tail = 0;
+      std::size_t head_cache = 0;
+
+      cache_line_pad pad2;
+
+    public:
+      explicit spsc_ring(std::size_t capacity)
+        : mask(capacity - 1), slots(new ring_slot<T>[capacity]) {
+        /* nothing to do here */
+      }
+
+      ~spsc_ring() {
+        while (try_pop())
+          /* nothing to do here */;
+      }
+
+      // producer side
+      template<typename V>
+      bool try_push(V&& v) {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - head_cache > mask) {
+          head_cache = head.load(std::memory_order_acquire);
+          if (t - head_cache > mask)
+            return false;
+        }
+        slots[t & mask].put(std::forward<V>(v));
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+      }
+
+      // consumer side
+      std::optional<T> try_pop() {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h == tail_cache) {
+          tail_cache = tail.load(std::memory_order_acquire);
+          if (h == tail_cache)
+            return std::nullopt;
+        }
+        std::optional<T> v(slots[h & mask].take());
+        head.store(h + 1, std::memory_order_release);
+        return v;
+      }
+
+      // any thread; whether try_push respectively try_pop would succeed
+      bool can_push() const noexcept {
+        return tail.load(std::memory_order_relaxed) -
+               head.load(std::memory_order_acquire) <= mask;
+      }
+
+      bool can_pop() const noexcept {
+        return head.load(std::memory_order_relaxed) !=
+               tail.load(std::memory_order_acquire);
+      }
+  };
+
+  // Bounded ring after Dmitry Vyukov: every slot carries a sequence
+  // number telling whose turn it is, so producers and consumers only
+  // contend on their own index. A single consumer claims slots without
+  // compare and swap.
+  template<typename T, bool MultiConsumer>
+  class mpmc_ring {
+    protected:
+      struct slot : ring_slot<T> {
+          std::atomic<std::size_t> seq;
+      };
+
+      std::size_t mask;
+      std::unique_ptr<slot[]> slots;
+
+      cache_line_pad pad0;
+      std::atomic<std::size_t> head = 0;
+      cache_line_pad pad1;
+      std::atomic<std::size_t> tail = 0;
+      cache_line_pad pad2;
+
+    public:
+      explicit mpmc_ring(std::size_t capacity)
+        : mask(capacity - 1), slots(new slot[capacity]) {
+        for (std::size_t i = 0; i < capacity; ++i)
+          slots[i].seq.store(i, std::memory_order_relaxed);
+      }
+
+      ~mpmc_ring() {
+        while (try_pop())
+          /* nothing to do here */;
+      }
+
+      template<typename V>
+      bool try_push(V&& v) {
+        auto pos = tail.load(std::memory_order_relaxed);
+        slot* s;
+        while (true) {
+          s = &slots[pos & mask];
+          auto diff = static_cast<std::intptr_t>(
+            s->seq.load(std::memory_order_acquire) - pos
+          );
+          if (diff == 0) {
+            if (tail.compare_exchange_weak(pos, pos + 1,
+                                           std::memory_order_relaxed))
+              break;
+          }
+          else if (diff < 0)
+            return false;
+          else
+            pos = tail.load(std::memory_order_relaxed);
+        }
+        s->put(std::forward<V>(v));
+        s->seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+
+      std::optional<T> try_pop() {
+        auto pos = head.load(std::memory_order_relaxed);
+        slot* s;
+        while (true) {
+          s = &slots[pos & mask];
+          auto diff = static_cast<std::intptr_t>(
+            s->seq.load(std::memory_order_acquire) - (pos + 1)
+          );
+          if (diff == 0) {
+            if constexpr (!MultiConsumer) {
+              head.store(pos + 1, std::memory_order_relaxed);
+              break;
+            }
+            else if (head.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed))
+              break;
+          }
+          else if (diff < 0)
+            return std::nullopt;
+          else
+            pos = head.load(std::memory_order_relaxed);
+        }
+        std::optional<T> v(s->take());
+        s->seq.store(pos + mask + 1, std::memory_order_release);
+        return v;
+      }
+
+      bool can_push() const noexcept {
+        auto pos = tail.load(std::memory_order_relaxed);
+        return slots[pos & mask].seq.load(std::memory_order_acquire) == pos;
+      }
+
+      bool can_pop() const noexcept {
+        auto pos = head.load(std::memory_order_relaxed);
+        return slots[pos & mask].seq.load(std::memory_order_acquire) == pos + 1;
+      }
+  };
+
+  // ring types by topology
+  struct spsc_topology {
+      template<typename T>
+      using ring = spsc_ring<T>;
+  };
+
+  struct mpsc_topology {
+      template<typename T>
+      using ring = mpmc_ring<T, false>;
+  };
+
+  struct mpmc_topology {
+      template<typename T>
+      using ring = mpmc_ring<T, true>;
+  };
+
+}
+
+namespace covent {
+
+  // Bounded queue between coroutines, on the same or on different
+  // loops. Sending and receiving don't suspend while there is space
+  // respectively items left; otherwise the coroutine waits in a node
+  // living in its awaiter, so nothing gets allocated. Waking a
+  // coroutine on another loop goes through the ring of that loop, no
+  // locks involved.
+  //
+  // Topology is the number of coroutines allowed to send and receive
+  // at the same time. Waiters can't be cancelled: close() the channel
+  // to release them. It has to outlive all of them.
+  template<typename T, typename Topology>
+  class basic_channel {
+    protected:
+      using waiter = detail::parked_waiter;
+      using waiters = detail::parking_lot<detail::atomic_sync>;
+
+      typename Topology::template ring<T> ring;
+      waiters receivers;
+      waiters senders;
+      std::atomic<bool> closing = false;
+
+      bool can_recv() const noexcept {
+        return ring.can_pop() || closing.load(std::memory_order_relaxed);
+      }
+
+      bool can_send() const noexcept {
+        return ring.can_push() || closing.load(std::memory_order_relaxed);
+      }
+
+      // settle both sides until neither makes progress, then resume
+      // the completed waiters once the channel isn't touched anymore
+      void settle_all(waiters& first) {
+        waiter* done = nullptr;
+        auto side = &first;
+        auto can = [&]() {
+          return side == &receivers ? can_recv() : can_send();
+        };
+        while (side->settle(done, can))
+          side = side == &receivers ? &senders : &receivers;
+        waiter::wake_all(done);
+      }
+
+      // after an operation of the fast path
+      void notify(waiters& side) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!side.empty())
+          settle_all(side);
+      }
+
+    public:
+      class send_awaiter : public waiter {
+        protected:
+          basic_channel& chan;
+          T value;
+          bool sent = false;
+
+        public:
+          template<typename V>
+          send_awaiter(basic_channel& c, V&& v)
+            : chan(c), value(std::forward<V>(v)) {
+            /* nothing to do here */
+          }
+
+          bool attempt() {
+            if (chan.closing.load(std::memory_order_acquire))
+              return true;
+            return sent = chan.ring.try_push(std::move(value));
+          }
+
+          bool await_ready() {
+            if (!attempt())
+              return false;
+            if (sent)
+              chan.notify(chan.receivers);
+            return true;
+          }
+
+          void await_suspend(std::coroutine_handle<> c) {
+            this->suspend(c);
+            chan.senders.park(this);
+            chan.settle_all(chan.senders);
+          }
+
+          // false if the channel was closed
+          bool await_resume() const noexcept {
+            return sent;
+          }
+      };
+
+      class recv_awaiter : public waiter {
+        protected:
+          basic_channel& chan;
+          std::optional<T> value;
+
+        public:
+          recv_awaiter(basic_channel& c) noexcept : chan(c) {
+            /* nothing to do here */
+          }
+
+          bool attempt() {
+            value = chan.ring.try_pop();
+            return value || chan.closing.load(std::memory_order_acquire);
+          }
+
+          bool await_ready() {
+            if (!attempt())
+              return false;
+            if (value)
+              chan.notify(chan.senders);
+            return true;
+          }
+
+          void await_suspend(std::coroutine_handle<> c) {
+            this->suspend(c);
+            chan.receivers.park(this);
+            chan.settle_all(chan.receivers);
+          }
+
+          // empty once the channel was closed and drained
+          std::optional<T> await_resume() {
+            return std::move(value);
+          }
+      };
+
+      // capacity is rounded up to a power of two
+      explicit basic_channel(std::size_t capacity)
+        : ring(std::bit_ceil(capacity < 2 ? 2 : capacity)) {
+        /* nothing to do here */
+      }
+
+      // not copyable
+      basic_channel(const basic_channel&) = delete;
+      basic_channel& operator=(const basic_channel&) = delete;
+
+      // co_await to send; yields false if the channel was closed
+      template<typename V>
+        requires std::is_constructible_v<T, V&&>
+      send_awaiter send(V&& v) {
+        return { *this, std::forward<V>(v) };
+      }
+
+      // co_await to receive; yields nothing once closed and drained.
+      // Bind the result to a variable, as in
+      //
+      //   while (auto v = co_await ch.recv())
+      //
+      // GCC 12 miscompiles a co_await expression used right as the
+      // condition of an if or while statement, as in
+      // while (co_await ch.recv()); the coroutine crashes on resume.
+      recv_awaiter recv() noexcept {
+        return { *this };
+      }
+
+      template<typename V>
+        requires std::is_constructible_v<T, V&&>
+      bool try_send(V&& v) {
+        if (closing.load(std::memory_order_acquire) ||
+            !ring.try_push(std::forward<V>(v)))
+          return false;
+        notify(receivers);
+        return true;
+      }
+
+      std::optional<T> try_recv() {
+        auto v = ring.try_pop();
+        if (v)
+          notify(senders);
+        return v;
+      }
+
+      // Sending fails from now on, receiving once the items left are
+      // gone. Releases all waiters that can't complete anymore.
+      void close() {
+        closing.store(true, std::memory_order_release);
+        settle_all(receivers);
+        settle_all(senders);
+      }
+
+      bool closed() const noexcept {
+        return closing.load(std::memory_order_acquire);
+      }
+  };
+
+  // any number of senders and receivers
+  template<typename T>
+  using channel = basic_channel<T, detail::mpmc_topology>;
+
+  // any number of senders, a single receiver
+  template<typename T>
+  using mpsc_channel = basic_channel<T, detail::mpsc_topology>;
+
+  // a single sender and a single receiver
+  template<typename T>
+  using spsc_channel = basic_channel<T, detail::spsc_topology>;
+
+}
+
+#endif
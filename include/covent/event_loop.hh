@@ -19,9 +19,8 @@
 #include <covent/evloops.hh>
 #include <covent/task.hh>
 
-#include <any>
-#include <map>
-#include <string>
+#include <stdexcept>
+#include <type_traits>
 #include <utility>
 
 namespace covent::detail {
@@ -51,38 +50,54 @@ namespace covent::detail {
 
 namespace covent {
 
-  class event_loop_config {
+  // Event loop talking to its implementation through loops of type
+  // Loop: the virtual interface, any implementation can be used then,
+  // or a single implementation called directly.
+  template<typename Loop>
+  class basic_event_loop {
     protected:
-      std::map<std::string, std::any> values;
+      Loop* impl;
+
+      // specialized by each event loop implementation
+      template<typename ImplType>
+      static detail::evloop_base* create(const event_loop_config&&);
+
+      template<typename ImplType>
+      static constexpr bool supports =
+        std::is_same_v<Loop, detail::evloop_base> ||
+        std::is_same_v<Loop, ImplType>;
+
+      template<typename ImplType>
+      static Loop* create_as(const event_loop_config&& conf) {
+        static_assert(supports<ImplType>,
+                      "library built for another event loop implementation");
+        return static_cast<Loop*>(create<ImplType>(std::move(conf)));
+      }
 
     public:
-      event_loop_config(std::initializer_list<decltype(values)::value_type>&& v)
-        : values(std::forward<decltype(v)>(v)) {
+      template<typename ImplType = DefaultEventLoopType>
+      basic_event_loop(const event_loop_config&& conf = {})
+        : impl(create_as<ImplType>(std::move(conf))) {
         /* nothing to do here */
       }
 
-      template<typename T, typename C = T>
-        requires std::is_convertible_v<T, C>
-      T get(std::string&& key, T&& def) const {
-        if (auto item = values.find(key); item != values.end())
-          return static_cast<C>(std::any_cast<T>(item->second));
-        return def;
+      // with the given implementation, e.g. std::in_place_type<evloop_epoll>
+      template<typename ImplType>
+      explicit basic_event_loop(std::in_place_type_t<ImplType>,
+                                const event_loop_config&& conf = {})
+        : impl(create_as<ImplType>(std::move(conf))) {
+        /* nothing to do here */
       }
-  };
 
-  class event_loop {
-    protected:
-      detail::evloop_base* impl;
-
-    public:
-      template<typename ImplType = DefaultEventLoopType>
-      event_loop(const event_loop_config&& conf = {});
+      // with the implementation of the given name, e.g. "epoll", the
+      // default one if empty or nullptr
+      explicit basic_event_loop(const char*, const event_loop_config&& = {});
 
       // not copyable
-      event_loop(const event_loop&) = delete;
-      event_loop& operator=(const event_loop&) = delete;
+      basic_event_loop(const basic_event_loop&) = delete;
+      basic_event_loop& operator=(const basic_event_loop&) = delete;
 
-      ~event_loop() {
+      ~basic_event_loop() {
         delete impl;
       }
 
@@ -99,8 +114,14 @@ namespace covent {
         detail::set_active_loop(nullptr);
         return tsk.result();
       }
+
+      const event_loop_stats& stats() const noexcept {
+        return impl->get_stats();
+      }
   };
 
+  using event_loop = basic_event_loop<detail::loop_type>;
+
   event_loop& get_event_loop(const event_loop_config&& = {});
 
   template<typename Func, typename ...Args>
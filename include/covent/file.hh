@@ -0,0 +1,203 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_FILE_HH
+#define COVENT_FILE_HH
+
+#include <covent/base.hh>
+#include <covent/fixed.hh>
+#include <covent/obstream.hh>
+#include <covent/ops.hh>
+#include <covent/resource.hh>
+#include <covent/task.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <sys/stat.h>
+#include <utility>
+
+namespace covent {
+
+  // heap buffer with its address and size aligned as O_DIRECT needs it
+  class aligned_buffer {
+    protected:
+      std::byte* buf = nullptr;
+      std::size_t len = 0;
+
+    public:
+      aligned_buffer() noexcept = default;
+      explicit aligned_buffer(std::size_t size, std::size_t alignment = 4096);
+
+      aligned_buffer(aligned_buffer&& other) noexcept
+        : buf(std::exchange(other.buf, nullptr)),
+          len(std::exchange(other.len, 0)) {
+        /* nothing to do here */
+      }
+
+      aligned_buffer& operator=(aligned_buffer&& other) noexcept;
+      ~aligned_buffer();
+
+      // not copyable
+      aligned_buffer(const aligned_buffer&) = delete;
+      aligned_buffer& operator=(const aligned_buffer&) = delete;
+
+      std::byte* data() const noexcept {
+        return buf;
+      }
+
+      std::size_t size() const noexcept {
+        return len;
+      }
+
+      // give up ownership without freeing the memory
+      std::byte* release() noexcept {
+        len = 0;
+        return std::exchange(buf, nullptr);
+      }
+  };
+
+  // An open file. Offsets of -1 read and write at the file position.
+  class file : public fd_resource {
+    public:
+      using fd_resource::fd_resource;
+
+      op::read read(void* buf, std::size_t len,
+                    std::uint64_t offset) const noexcept {
+        return { fd, buf, len, offset, fixed };
+      }
+
+      op::read read(fixed_buffer& buf, std::size_t len,
+                    std::uint64_t offset) const noexcept {
+        return { fd, buf.data(), len, offset, fixed, buf.index() };
+      }
+
+      op::write write(const void* buf, std::size_t len,
+                      std::uint64_t offset) const noexcept {
+        return { fd, buf, len, offset, fixed };
+      }
+
+      op::write write(const fixed_buffer& buf, std::size_t len,
+                      std::uint64_t offset) const noexcept {
+        return { fd, buf.data(), len, offset, fixed, buf.index() };
+      }
+
+      // write everything written to out with a single submission
+      op::writev write(const obstream& out,
+                       std::uint64_t offset) const noexcept {
+        auto iov = out.iovecs();
+        return { fd, iov.data(), static_cast<unsigned>(iov.size()),
+                 offset, fixed };
+      }
+
+      op::fsync sync() const noexcept {
+        return { fd, false, fixed };
+      }
+
+      // flush the data but only the metadata needed to read it back
+      op::fsync datasync() const noexcept {
+        return { fd, true, fixed };
+      }
+
+      op::fallocate allocate(std::uint64_t offset, std::uint64_t len,
+                             int mode = 0) const noexcept {
+        return { fd, mode, offset, len, fixed };
+      }
+
+      // not available for fixed files
+      op::statx stat(struct ::statx& buf,
+                     unsigned mask = STATX_BASIC_STATS) const noexcept {
+        return { fd, "", AT_EMPTY_PATH, mask, &buf };
+      }
+
+      // close asynchronously, handing over the descriptor to the loop
+      op::close close_async() noexcept {
+        return { std::exchange(fd, -1), fixed };
+      }
+  };
+
+  task<file> open_file(std::string path, int flags = O_RDONLY | O_CLOEXEC,
+                       mode_t mode = 0644);
+
+  // Reads a file front to back in blocks, keeping depth reads in flight
+  // so a single coroutine can keep fast storage busy. Buffers are
+  // aligned for O_DIRECT. Each block stays valid until the next one is
+  // requested.
+  class file_reader {
+    protected:
+      struct pending_read {
+          detail::event_awaiter aw;
+          std::uint64_t offset;
+
+          template<typename Factory>
+          pending_read(Factory&& create, std::uint64_t off)
+            : aw(create()), offset(off) {
+            /* nothing to do here */
+          }
+      };
+
+      struct block {
+          aligned_buffer buf;
+          std::optional<pending_read> read;
+      };
+
+      int fd;
+      bool fixed;
+      std::size_t block_size;
+      unsigned depth;
+      std::uint64_t next_offset;
+      std::uint64_t end;
+      std::unique_ptr<block[]> blocks;
+      unsigned head = 0;
+      bool consumed = false;
+
+      void issue(block&);
+
+    public:
+      class awaiter {
+        protected:
+          file_reader& reader;
+
+        public:
+          awaiter(file_reader& r) noexcept : reader(r) {
+            /* nothing to do here */
+          }
+
+          bool await_ready();
+          void await_suspend(std::coroutine_handle<>);
+
+          // empty at the end of the file
+          std::span<const std::byte> await_resume();
+      };
+
+      file_reader(const file&, std::size_t block_size = 1 << 17,
+                  unsigned depth = 8, std::uint64_t offset = 0,
+                  std::uint64_t length = std::numeric_limits<std::uint64_t>::max());
+      ~file_reader();
+
+      // not copyable
+      file_reader(const file_reader&) = delete;
+      file_reader& operator=(const file_reader&) = delete;
+
+      awaiter next();
+  };
+
+}
+
+#endif
@@ -0,0 +1,122 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_FIXED_HH
+#define COVENT_FIXED_HH
+
+#include <cstddef>
+#include <utility>
+
+namespace covent::detail {
+
+  class fixed_buffer_pool_impl;
+
+}
+
+namespace covent {
+
+  // A buffer registered in the fixed buffer table of the loop it was
+  // acquired on, returned to its pool on destruction. I/O using it
+  // skips pinning the pages on every operation. It can be moved between
+  // tasks of the same loop but mustn't be released while I/O using it
+  // is still pending.
+  class fixed_buffer {
+    protected:
+      detail::fixed_buffer_pool_impl* pool = nullptr;
+      std::byte* buf = nullptr;
+      std::size_t len = 0;
+      int idx = -1;
+
+    public:
+      fixed_buffer() noexcept = default;
+      fixed_buffer(detail::fixed_buffer_pool_impl*, std::byte*,
+                   std::size_t, int) noexcept;
+
+      fixed_buffer(fixed_buffer&& other) noexcept
+        : pool(std::exchange(other.pool, nullptr)),
+          buf(other.buf), len(other.len), idx(other.idx) {
+        /* nothing to do here */
+      }
+
+      fixed_buffer& operator=(fixed_buffer&& other) noexcept {
+        if (&other != this) {
+          reset();
+          pool = std::exchange(other.pool, nullptr);
+          buf = other.buf;
+          len = other.len;
+          idx = other.idx;
+        }
+        return *this;
+      }
+
+      ~fixed_buffer() {
+        reset();
+      }
+
+      // not copyable
+      fixed_buffer(const fixed_buffer&) = delete;
+      fixed_buffer& operator=(const fixed_buffer&) = delete;
+
+      void reset() noexcept;
+
+      explicit operator bool() const noexcept {
+        return pool != nullptr;
+      }
+
+      std::byte* data() const noexcept {
+        return buf;
+      }
+
+      std::size_t size() const noexcept {
+        return len;
+      }
+
+      // index in the fixed buffer table
+      int index() const noexcept {
+        return idx;
+      }
+  };
+
+  // Handle to count page aligned buffers of size bytes each, registered
+  // as a consecutive range of the fixed buffer table of the active loop.
+  // The table size is set by the "registered_buffers" configuration key.
+  // The registration is dropped once the pool and all its buffers are
+  // gone.
+  class fixed_buffer_pool {
+    protected:
+      detail::fixed_buffer_pool_impl* impl;
+
+    public:
+      fixed_buffer_pool(unsigned count, std::size_t size);
+
+      fixed_buffer_pool(fixed_buffer_pool&& other) noexcept
+        : impl(std::exchange(other.impl, nullptr)) {
+        /* nothing to do here */
+      }
+
+      ~fixed_buffer_pool();
+
+      // not copyable
+      fixed_buffer_pool(const fixed_buffer_pool&) = delete;
+      fixed_buffer_pool& operator=(const fixed_buffer_pool&) = delete;
+
+      // an empty buffer if all of them are in use
+      fixed_buffer acquire();
+
+      std::size_t available() const noexcept;
+  };
+
+}
+
+#endif
@@ -0,0 +1,188 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_GENERATOR_HH
+#define COVENT_GENERATOR_HH
+
+#include <covent/task.hh>
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace covent {
+
+  template<typename>
+  class async_generator;
+
+}
+
+namespace covent::detail {
+
+  template<typename T>
+  class generator_promise final : public promise_base<async_generator<T>> {
+    friend class async_generator<T>;
+
+    protected:
+      std::optional<T> slot;
+      std::coroutine_handle<> consumer = nullptr;
+
+      // hands control back to the consumer
+      class yield_awaiter {
+        protected:
+          std::coroutine_handle<> consumer;
+
+        public:
+          yield_awaiter(std::coroutine_handle<> c) noexcept : consumer(c) {
+            /* nothing to do here */
+          }
+
+          bool await_ready() const noexcept {
+            return false;
+          }
+
+          std::coroutine_handle<> await_suspend(std::coroutine_handle<>) noexcept {
+            return consumer;
+          }
+
+          void await_resume() const noexcept {
+            /* nothing to do here */
+          }
+      };
+
+    public:
+      template<typename V>
+        requires std::is_constructible_v<T, V&&>
+      yield_awaiter yield_value(V&& v)
+        noexcept ( std::is_nothrow_constructible_v<T, V&&> ) {
+        slot.emplace(std::forward<V>(v));
+        return { consumer };
+      }
+
+      void return_void() noexcept {
+        /* nothing to do here */
+      }
+
+      yield_awaiter final_suspend() noexcept {
+        return { consumer };
+      }
+  };
+
+}
+
+namespace covent {
+
+  // Coroutine producing values one after the other with co_yield,
+  // awaiting events in between as a task does. It runs only while the
+  // consumer awaits next(), up to the following co_yield, and resumes
+  // the consumer by symmetric transfer; values aren't buffered. Pair it
+  // with an event_stream to have completions of multishot operations
+  // buffered while the consumer is busy.
+  //
+  //   while (auto v = co_await gen.next())
+  //     use(*v);
+  template<typename T>
+  class [[nodiscard]] async_generator {
+    static_assert(!std::is_reference_v<T>, "async_generator yields values");
+
+    public:
+      using sync_type = detail::local_sync;
+      using promise_type = detail::generator_promise<T>;
+      using handle_type = std::coroutine_handle<promise_type>;
+
+    protected:
+      handle_type coro;
+
+    public:
+      class awaiter {
+        protected:
+          handle_type coro;
+
+        public:
+          awaiter(handle_type c) noexcept : coro(c) {
+            /* nothing to do here */
+          }
+
+          bool await_ready() const noexcept {
+            return coro == nullptr || coro.done();
+          }
+
+          std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+            coro.promise().consumer = c;
+            return coro;
+          }
+
+          // the next value, or nothing once the generator returned
+          std::optional<T> await_resume() {
+            if (coro == nullptr)
+              return std::nullopt;
+
+            auto& prms = coro.promise();
+            if (prms.exception != nullptr)
+              std::rethrow_exception(prms.exception);
+            if (coro.done())
+              return std::nullopt;
+
+            std::optional<T> res = std::move(prms.slot);
+            prms.slot.reset();
+            return res;
+          }
+      };
+
+      async_generator() noexcept : coro(nullptr) {
+        /* nothing to do here */
+      }
+
+      explicit async_generator(handle_type c) noexcept : coro(c) {
+        /* nothing to do here */
+      }
+
+      async_generator(async_generator&& other) noexcept
+        : coro(std::exchange(other.coro, nullptr)) {
+        /* nothing to do here */
+      }
+
+      async_generator& operator=(async_generator&& other) noexcept {
+        if (&other != this) {
+          if (coro)
+            coro.destroy();
+          coro = std::exchange(other.coro, nullptr);
+        }
+        return *this;
+      }
+
+      ~async_generator() {
+        if (coro)
+          coro.destroy();
+      }
+
+      // not copyable
+      async_generator(const async_generator&) = delete;
+      async_generator& operator=(const async_generator&) = delete;
+
+      // true once the generator returned
+      bool done() const noexcept {
+        return coro == nullptr || coro.done();
+      }
+
+      awaiter next() const noexcept {
+        return { coro };
+      }
+  };
+
+}
+
+#endif
@@ -0,0 +1,115 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_NET_HH
+#define COVENT_NET_HH
+
+#include <covent/buffers.hh>
+#include <covent/fixed.hh>
+#include <covent/obstream.hh>
+#include <covent/ops.hh>
+#include <covent/resource.hh>
+#include <covent/stream.hh>
+#include <covent/task.hh>
+
+#include <cstdint>
+#include <sys/socket.h>
+
+namespace covent {
+
+  class tcp_connection : public fd_resource {
+    public:
+      using fd_resource::fd_resource;
+
+      op::recv recv(void* buf, std::size_t len, int flags = 0) const noexcept {
+        return { fd, buf, len, flags, fixed };
+      }
+
+      // Stream of received data from a single multishot submission,
+      // each result being a buffer of group. At most buffer results are
+      // held before receiving is paused.
+      event_stream<buffer_view> recv_stream(const buffer_group&,
+                                            std::size_t buffer = 64) const;
+
+      op::send send(const void* buf, std::size_t len,
+                    int flags = MSG_NOSIGNAL) const noexcept {
+        return { fd, buf, len, flags, fixed };
+      }
+
+      // zero copy send from a fixed buffer
+      op::send send(const fixed_buffer& buf, std::size_t len,
+                    int flags = MSG_NOSIGNAL) const noexcept {
+        return { fd, buf.data(), len, flags, fixed, buf.index() };
+      }
+
+      // receive into a fixed buffer
+      op::read read(fixed_buffer& buf) const noexcept {
+        return { fd, buf.data(), buf.size(), std::uint64_t(-1), fixed, buf.index() };
+      }
+
+      // send everything written to out with a single submission
+      op::sendmsg send(const obstream& out,
+                       int flags = MSG_NOSIGNAL | MSG_WAITALL) const noexcept {
+        return { fd, out.message(), flags, fixed, false };
+      }
+
+      // same without copying; worth it for large payloads only, since
+      // the kernel has to pin the pages and notify once it's done
+      op::sendmsg send_zc(const obstream& out,
+                          int flags = MSG_NOSIGNAL | MSG_WAITALL) const noexcept {
+        return { fd, out.message(), flags, fixed, true };
+      }
+
+      op::shutdown shutdown(int how = SHUT_WR) const noexcept {
+        return { fd, how, fixed };
+      }
+  };
+
+  struct listen_options {
+      int backlog = SOMAXCONN;
+      bool reuseaddr = true;
+      bool reuseport = false;
+  };
+
+  struct accept_stream_options {
+      // accept into the fixed file table of the loop
+      bool direct = false;
+      // connections buffered before accepting is paused
+      std::size_t buffer = 64;
+      int flags = SOCK_CLOEXEC;
+  };
+
+  class tcp_acceptor : public fd_resource {
+    public:
+      using fd_resource::fd_resource;
+
+      // completes with the file descriptor of the accepted connection
+      op::accept accept(int flags = SOCK_CLOEXEC) const noexcept {
+        return { fd, flags, fixed };
+      }
+
+      // Stream of accepted connections from a single multishot
+      // submission. Each result is a file descriptor, a fixed file
+      // index if direct is set, or a negated errno value.
+      event_stream<int> accept_stream(const accept_stream_options& = {}) const;
+  };
+
+  tcp_acceptor listen_tcp(const socket_address&, const listen_options& = {});
+  tcp_acceptor listen_tcp(std::uint16_t, const listen_options& = {});
+
+  task<tcp_connection> connect_tcp(socket_address);
+
+}
+
+#endif
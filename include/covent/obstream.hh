@@ -0,0 +1,135 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_OBSTREAM_HH
+#define COVENT_OBSTREAM_HH
+
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
+
+namespace covent {
+
+  // Binary output stream serializing into a chain of fixed size slabs.
+  // The slabs are handed to the kernel as an iovec array by a single
+  // sendmsg or writev submission, so frames never get copied into a
+  // contiguous buffer. Large payloads can be referenced instead of
+  // copied; they have to stay alive until the write completed. The
+  // kernel accepts at most IOV_MAX slabs and references per write.
+  class obstream {
+    protected:
+      std::endian endian;
+      std::size_t slab_size;
+      std::vector<std::unique_ptr<std::byte[]>> slabs;
+      std::size_t current = 0;
+      std::size_t pos = 0;
+      std::size_t total = 0;
+      std::vector<iovec> iov;
+      mutable msghdr msg = {};
+
+      void append(const std::byte* src, std::size_t len) {
+        while (len > 0) {
+          if (slabs.empty() || pos == slab_size) {
+            if (!slabs.empty())
+              ++current;
+            if (current == slabs.size())
+              slabs.emplace_back(new std::byte[slab_size]);
+            pos = 0;
+          }
+
+          auto dst = slabs[current].get() + pos;
+          auto n = std::min(len, slab_size - pos);
+          std::memcpy(dst, src, n);
+
+          // grow the last iovec if this continues it
+          if (!iov.empty() &&
+              static_cast<std::byte*>(iov.back().iov_base) +
+                iov.back().iov_len == dst)
+            iov.back().iov_len += n;
+          else
+            iov.push_back({ dst, n });
+
+          pos += n;
+          total += n;
+          src += n;
+          len -= n;
+        }
+      }
+
+    public:
+      explicit obstream(std::endian e = std::endian::big,
+                        std::size_t size = 4096)
+        : endian(e), slab_size(size) {
+        /* nothing to do here */
+      }
+
+      template<typename T>
+      requires std::integral<T> || std::floating_point<T>
+      obstream& operator<<(T value) {
+        std::byte bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        if (endian != std::endian::native)
+          std::reverse(bytes, bytes + sizeof(T));
+        append(bytes, sizeof(T));
+        return *this;
+      }
+
+      // copy raw bytes into the slabs
+      obstream& write(const void* src, std::size_t len) {
+        append(static_cast<const std::byte*>(src), len);
+        return *this;
+      }
+
+      // add memory to the chain without copying it
+      obstream& reference(std::span<const std::byte> data) {
+        if (data.empty())
+          return *this;
+        iov.push_back({ const_cast<std::byte*>(data.data()), data.size() });
+        total += data.size();
+        return *this;
+      }
+
+      // forget everything written, keeping the slabs for reuse
+      void clear() noexcept {
+        iov.clear();
+        current = 0;
+        pos = 0;
+        total = 0;
+      }
+
+      std::size_t size() const noexcept {
+        return total;
+      }
+
+      std::span<const iovec> iovecs() const noexcept {
+        return iov;
+      }
+
+      const msghdr* message() const noexcept {
+        msg.msg_iov = const_cast<iovec*>(iov.data());
+        msg.msg_iovlen = iov.size();
+        return &msg;
+      }
+  };
+
+}
+
+#endif
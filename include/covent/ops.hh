@@ -0,0 +1,202 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_OPS_HH
+#define COVENT_OPS_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace covent::detail {
+
+  class buffer_group_impl;
+
+}
+
+namespace covent {
+
+  // IPv4 or IPv6 socket address
+  class socket_address {
+    public:
+      union {
+          sockaddr sa;
+          sockaddr_in in;
+          sockaddr_in6 in6;
+      };
+      socklen_t len = 0;
+
+      static socket_address ipv4(const char*, std::uint16_t);
+      static socket_address ipv6(const char*, std::uint16_t);
+
+      // wildcard address for listening
+      static socket_address any(std::uint16_t);
+
+      int family() const noexcept {
+        return sa.sa_family;
+      }
+  };
+
+}
+
+// Descriptions of the operations event loop implementations know how to
+// await. All of them complete with the result of the corresponding
+// system call or a negated errno value. With fixed set, fd is an index
+// into the fixed file table of the loop; a buf_index other than -1 is
+// the index of buf in its fixed buffer table.
+namespace covent::op {
+
+  struct accept {
+      int fd;
+      int flags;
+      bool fixed = false;
+  };
+
+  // keeps accepting from a single submission; with direct the results
+  // are indexes into the fixed file table instead of file descriptors
+  struct multishot_accept {
+      int fd;
+      int flags;
+      bool direct;
+      std::size_t buffer;
+      bool fixed = false;
+  };
+
+  struct connect {
+      int fd;
+      socket_address addr;
+      bool fixed = false;
+  };
+
+  struct recv {
+      int fd;
+      void* buf;
+      std::size_t len;
+      int flags;
+      bool fixed = false;
+  };
+
+  // keeps receiving from a single submission into buffers the kernel
+  // picks from group
+  struct recv_multishot {
+      int fd;
+      detail::buffer_group_impl* group;
+      std::size_t buffer;
+      bool fixed = false;
+  };
+
+  // keeps reporting readiness of fd for events from a single
+  // submission
+  struct poll_multishot {
+      int fd;
+      unsigned events;
+      std::size_t buffer;
+      bool fixed = false;
+  };
+
+  // sends from a fixed buffer are zero copy
+  struct send {
+      int fd;
+      const void* buf;
+      std::size_t len;
+      int flags;
+      bool fixed = false;
+      int buf_index = -1;
+  };
+
+  // with zerocopy the pages are sent without copying them and the
+  // operation only completes once the kernel is done with them
+  struct sendmsg {
+      int fd;
+      const msghdr* msg;
+      int flags;
+      bool fixed = false;
+      bool zerocopy = false;
+  };
+
+  struct writev {
+      int fd;
+      const iovec* iov;
+      unsigned count;
+      std::uint64_t offset;
+      bool fixed = false;
+  };
+
+  // an offset of -1 uses and advances the file position
+  struct read {
+      int fd;
+      void* buf;
+      std::size_t len;
+      std::uint64_t offset;
+      bool fixed = false;
+      int buf_index = -1;
+  };
+
+  struct write {
+      int fd;
+      const void* buf;
+      std::size_t len;
+      std::uint64_t offset;
+      bool fixed = false;
+      int buf_index = -1;
+  };
+
+  // path has to stay valid until the operation completes
+  struct openat {
+      int dirfd;
+      const char* path;
+      int flags;
+      mode_t mode;
+  };
+
+  struct fsync {
+      int fd;
+      bool datasync;
+      bool fixed = false;
+  };
+
+  struct fallocate {
+      int fd;
+      int mode;
+      std::uint64_t offset;
+      std::uint64_t len;
+      bool fixed = false;
+  };
+
+  struct statx {
+      int dirfd;
+      const char* path;
+      int flags;
+      unsigned mask;
+      struct ::statx* buf;
+  };
+
+  struct close {
+      int fd;
+      bool fixed = false;
+  };
+
+  struct shutdown {
+      int fd;
+      int how;
+      bool fixed = false;
+  };
+
+}
+
+#endif
@@ -0,0 +1,159 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_PARKING_HH
+#define COVENT_PARKING_HH
+
+#include <covent/base.hh>
+#include <covent/task.hh>
+
+#include <coroutine>
+#include <utility>
+
+namespace covent::detail {
+
+  // Coroutine waiting for a channel or synchronization primitive.
+  // Parked in a lock free stack; whoever takes it off the stack runs
+  // the operation on its behalf and either wakes the coroutine or
+  // parks it again. That's what lets the waiting side stay suspended
+  // while another thread completes it.
+  class parked_waiter : public posted_work {
+    public:
+      std::coroutine_handle<> coro;
+      evloop_base* loop;
+      parked_waiter* next;
+      waiter_list node;
+
+      // try to complete the operation; true if done
+      virtual bool attempt() = 0;
+
+      void run() {
+        coro.resume();
+      }
+
+      // Resume the coroutine on the loop it suspended on: through the
+      // ready queue on the same thread, through its ring otherwise.
+      // Coroutines not running on a loop are resumed right away.
+      void wake() {
+        if (loop == nullptr)
+          coro.resume();
+        else if (loop == find_active_loop()) {
+          node.continuation = coro;
+          loop->schedule(&node);
+        }
+        else
+          loop->post(this);
+      }
+
+      void suspend(std::coroutine_handle<> c) noexcept {
+        coro = c;
+        loop = find_active_loop();
+      }
+
+      // resume a list of completed waiters
+      static void wake_all(parked_waiter* w) {
+        while (w != nullptr)
+          std::exchange(w, w->next)->wake();
+      }
+  };
+
+  template<typename Sync>
+  class parking_lot {
+    protected:
+      typename Sync::template cell<parked_waiter*> head = nullptr;
+
+    public:
+      void park(parked_waiter* w) noexcept {
+        w->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(w->next, w,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed))
+          /* nothing to do here */;
+      }
+
+      // All waiters in the order they arrived in. Taking them all at
+      // once leaves no room for ABA.
+      parked_waiter* take() noexcept {
+        auto w = head.exchange(nullptr, std::memory_order_acquire);
+        parked_waiter* prev = nullptr;
+        while (w != nullptr)
+          prev = std::exchange(w, std::exchange(w->next, prev));
+        return prev;
+      }
+
+      bool empty() const noexcept {
+        return head.load(std::memory_order_relaxed) == nullptr;
+      }
+
+      // Run the operations of the parked waiters, appending those that
+      // completed to done and parking the others again. Goes another
+      // round while can() says the state changed in the meantime.
+      // Returns whether any completed.
+      template<typename Check>
+      bool settle(parked_waiter*& done, Check&& can) {
+        bool progress = false;
+        auto tail = &done;
+        while (*tail != nullptr)
+          tail = &(*tail)->next;
+
+        while (true) {
+          Sync::fence();
+          auto w = take();
+          if (w == nullptr)
+            return progress;
+
+          bool parked = false;
+          while (w != nullptr) {
+            auto next = w->next;
+            if (w->attempt()) {
+              w->next = nullptr;
+              *tail = w;
+              tail = &w->next;
+              progress = true;
+            }
+            else {
+              park(w);
+              parked = true;
+            }
+            w = next;
+          }
+
+          // the state might have changed before the parked ones got
+          // back on the stack
+          Sync::fence();
+          if (!parked || !can())
+            return progress;
+        }
+      }
+
+      // settle and resume the completed waiters right away
+      template<typename Check>
+      void settle(Check&& can) {
+        parked_waiter* done = nullptr;
+        settle(done, std::forward<Check>(can));
+        parked_waiter::wake_all(done);
+      }
+
+      // after a state change outside of settle
+      template<typename Check>
+      void notify(Check&& can) {
+        Sync::fence();
+        if (!empty())
+          settle(std::forward<Check>(can));
+      }
+  };
+
+}
+
+#endif
@@ -0,0 +1,200 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_POOL_HH
+#define COVENT_POOL_HH
+
+#include <covent/base.hh>
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+namespace covent {
+
+  class work_pool;
+
+  // Handle of an event loop that coroutines running on other threads
+  // can be resumed on.
+  class loop_ref {
+    protected:
+      detail::evloop_base* impl;
+
+    public:
+      loop_ref(detail::evloop_base* l = nullptr) noexcept : impl(l) {
+        /* nothing to do here */
+      }
+
+      explicit operator bool() const noexcept {
+        return impl != nullptr;
+      }
+
+      detail::evloop_base* get() const noexcept {
+        return impl;
+      }
+
+      bool operator==(const loop_ref&) const noexcept = default;
+  };
+
+  // the loop running on the calling thread, empty if there is none
+  inline loop_ref this_loop() noexcept {
+    return detail::find_active_loop();
+  }
+
+  // counters describing the work a pool has been doing
+  struct work_pool_stats {
+    // coroutines resumed by the workers
+    std::uint64_t executed = 0;
+    // coroutines submitted from threads outside of the pool
+    std::uint64_t injected = 0;
+    // coroutines taken from the queue of another worker
+    std::uint64_t steals = 0;
+    // rounds of stealing that came back empty handed
+    std::uint64_t steal_misses = 0;
+    // coroutines currently queued, summed over all queues
+    std::size_t queued = 0;
+    // most coroutines currently queued with a single worker
+    std::size_t max_depth = 0;
+  };
+
+}
+
+namespace covent::detail {
+
+  // awaiter continuing the awaiting coroutine on a pool worker
+  class schedule_awaiter : public loop_hop {
+    protected:
+      work_pool& pool;
+      evloop_base* origin = nullptr;
+
+    public:
+      schedule_awaiter(work_pool& p) noexcept : pool(p) {
+        /* nothing to do here */
+      }
+
+      bool await_ready() const noexcept {
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<>);
+
+      // the loop the coroutine left, to get back to it later
+      loop_ref await_resume() const noexcept {
+        return origin;
+      }
+  };
+
+  // awaiter continuing the awaiting coroutine on a loop
+  class resume_awaiter : public loop_hop, public posted_work {
+    protected:
+      evloop_base* dest;
+      std::coroutine_handle<> coro;
+
+    public:
+      resume_awaiter(loop_ref l) noexcept : dest(l.get()) {
+        /* nothing to do here */
+      }
+
+      bool await_ready() const noexcept {
+        return dest == nullptr || dest == find_active_loop();
+      }
+
+      void await_suspend(std::coroutine_handle<> c) {
+        coro = c;
+        dest->post(this);
+      }
+
+      void await_resume() const noexcept {
+        /* nothing to do here */
+      }
+
+      void run() {
+        coro.resume();
+      }
+  };
+
+}
+
+namespace covent {
+
+  // Threads for CPU bound work, so it doesn't stall the I/O of a loop.
+  // Each worker has a Chase-Lev deque it runs coroutines from; idle
+  // ones steal from the others. Coroutines arriving from outside the
+  // pool are queued up centrally.
+  //
+  // Tasks started on a loop may finish on a worker; their frames find
+  // their way back to the frame pool of the loop. I/O can't be awaited
+  // on a worker though.
+  class work_pool {
+    friend class detail::schedule_awaiter;
+
+    protected:
+      struct worker;
+
+      std::size_t count;
+      std::unique_ptr<worker[]> workers;
+
+      // coroutines submitted from outside of the pool
+      std::mutex inject_lock;
+      std::deque<std::coroutine_handle<>> injected;
+      std::atomic<std::size_t> injected_size = 0;
+      std::atomic<std::uint64_t> injected_total = 0;
+
+      // idle workers wait for this to change
+      std::atomic<std::uint32_t> epoch = 0;
+      std::atomic<unsigned> sleepers = 0;
+      std::atomic<bool> stopping = false;
+
+      void submit(std::coroutine_handle<>);
+      std::coroutine_handle<> find_work(worker&);
+      void run(worker&);
+
+    public:
+      // starts threads workers, by default one per core
+      explicit work_pool(unsigned threads = 0);
+
+      // resumes all queued coroutines before returning
+      ~work_pool();
+
+      // not copyable
+      work_pool(const work_pool&) = delete;
+      work_pool& operator=(const work_pool&) = delete;
+
+      std::size_t size() const noexcept {
+        return count;
+      }
+
+      // coroutines queued with a worker
+      std::size_t depth(std::size_t) const noexcept;
+
+      work_pool_stats stats() const noexcept;
+  };
+
+  // co_await to continue on a worker of the pool; yields the loop left
+  inline detail::schedule_awaiter schedule_on(work_pool& pool) noexcept {
+    return { pool };
+  }
+
+  // co_await to continue on the given loop
+  inline detail::resume_awaiter resume_on(loop_ref loop) noexcept {
+    return { loop };
+  }
+
+}
+
+#endif
@@ -0,0 +1,78 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_RESOURCE_HH
+#define COVENT_RESOURCE_HH
+
+#include <covent/stream.hh>
+
+#include <cstddef>
+
+namespace covent {
+
+  namespace detail {
+    class fixed_closer;
+  }
+
+  // owns a file descriptor, or an entry of the fixed file table of the
+  // loop it was registered with if fixed is set, and closes it on
+  // destruction
+  class fd_resource {
+    protected:
+      int fd = -1;
+      bool fixed = false;
+
+      // closes the fixed file table entry on the loop owning it;
+      // allocated up front so closing can't fail
+      detail::fixed_closer* closer = nullptr;
+
+    public:
+      fd_resource() noexcept = default;
+      explicit fd_resource(int, bool = false) noexcept;
+      fd_resource(fd_resource&&) noexcept;
+      fd_resource& operator=(fd_resource&&) noexcept;
+      ~fd_resource();
+
+      // not copyable
+      fd_resource(const fd_resource&) = delete;
+      fd_resource& operator=(const fd_resource&) = delete;
+
+      int native_handle() const noexcept {
+        return fd;
+      }
+
+      bool is_fixed() const noexcept {
+        return fixed;
+      }
+
+      explicit operator bool() const noexcept {
+        return fd >= 0;
+      }
+
+      void close() noexcept;
+
+      // move the descriptor into the fixed file table of the active
+      // loop, saving the file lookup on every operation
+      void make_fixed();
+
+      // Readiness for the poll(2) events given, from a single multishot
+      // submission. Each result is the mask of events that occurred or
+      // a negated errno value.
+      event_stream<int> poll_stream(unsigned events,
+                                    std::size_t buffer = 16) const;
+  };
+
+}
+
+#endif
@@ -0,0 +1,194 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_RUNTIME_HH
+#define COVENT_RUNTIME_HH
+
+#include <covent/base.hh>
+#include <covent/pool.hh>
+#include <covent/task.hh>
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace covent {
+
+  class runtime;
+
+}
+
+namespace covent::detail {
+
+  // coroutine running a spawned task to completion on its own
+  class detached_task {
+    public:
+      class promise_type {
+        public:
+          detached_task get_return_object() noexcept {
+            return {};
+          }
+
+          std::suspend_never initial_suspend() const noexcept {
+            return {};
+          }
+
+          std::suspend_never final_suspend() const noexcept {
+            return {};
+          }
+
+          void return_void() const noexcept {
+            /* nothing to do here */
+          }
+
+          // like an exception escaping a thread
+          void unhandled_exception() const noexcept {
+            std::terminate();
+          }
+      };
+  };
+
+  // runtime bookkeeping of a task spawned on one of its loops
+  class spawned_base : public posted_work {
+    protected:
+      runtime& rt;
+      std::size_t index;
+
+    public:
+      spawned_base(runtime& r, std::size_t i) noexcept : rt(r), index(i) {
+        /* nothing to do here */
+      }
+
+      void finished() noexcept;
+  };
+
+  template<typename Func>
+  class spawned_work final : public spawned_base {
+    protected:
+      Func func;
+
+      static detached_task drive(spawned_work* self) {
+        std::unique_ptr<spawned_work> guard(self);
+        co_await self->func();
+        self->finished();
+      }
+
+    public:
+      spawned_work(runtime& r, std::size_t i, Func&& f)
+        : spawned_base(r, i), func(std::move(f)) {
+        /* nothing to do here */
+      }
+
+      void run() {
+        drive(this);
+      }
+  };
+
+}
+
+namespace covent {
+
+  // Loop per core runtime: one event loop per thread, each pinned to a
+  // core of its own. Tasks and wake ups are handed between loops
+  // through their rings, no locks or eventfds involved.
+  class runtime {
+    friend class detail::spawned_base;
+
+    protected:
+      struct worker {
+          std::thread thread;
+          detail::evloop_base* loop = nullptr;
+          std::coroutine_handle<> main = nullptr;
+          std::atomic<std::size_t> tasks = 0;
+      };
+
+      std::size_t count;
+      std::unique_ptr<worker[]> workers;
+      std::atomic<std::size_t> pending = 0;
+
+      void post(std::size_t, detail::posted_work*);
+
+    public:
+      // Starts threads loops, by default one per core, all configured
+      // the same. With "pin" set to false in the configuration they
+      // aren't pinned to cores; "evloop" names the implementation.
+      explicit runtime(const event_loop_config& = {}, unsigned threads = 0);
+
+      // waits for all spawned tasks to finish
+      ~runtime();
+
+      // not copyable
+      runtime(const runtime&) = delete;
+      runtime& operator=(const runtime&) = delete;
+
+      std::size_t size() const noexcept {
+        return count;
+      }
+
+      // number of spawned tasks not finished yet on a loop
+      std::size_t load(std::size_t index) const noexcept {
+        return workers[index].tasks.load(std::memory_order_relaxed);
+      }
+
+      std::size_t least_loaded() const noexcept;
+
+      // Run the task returned by calling func with args on the given
+      // loop. The arguments are stored until then. Exceptions escaping
+      // the task terminate the program.
+      template<typename Func, typename ...Args>
+      void spawn_on(std::size_t index, Func&& func, Args&& ...args) {
+        auto call = [f = std::forward<Func>(func),
+                     a = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+          return std::apply(f, std::move(a));
+        };
+        workers[index].tasks.fetch_add(1, std::memory_order_relaxed);
+        pending.fetch_add(1, std::memory_order_relaxed);
+        post(index, new detail::spawned_work<decltype(call)>(
+          *this, index, std::move(call)
+        ));
+      }
+
+      // same on the loop with the fewest unfinished tasks
+      template<typename Func, typename ...Args>
+      void spawn(Func&& func, Args&& ...args) {
+        spawn_on(least_loaded(), std::forward<Func>(func),
+                 std::forward<Args>(args)...);
+      }
+
+      loop_ref loop(std::size_t index) const noexcept {
+        return workers[index].loop;
+      }
+
+      // co_await to continue on the given loop
+      detail::resume_awaiter switch_to(std::size_t index) noexcept {
+        return resume_on(loop(index));
+      }
+
+      // block until all spawned tasks finished
+      void wait();
+
+      // end all loops, abandoning tasks still running
+      void stop();
+  };
+
+}
+
+#endif
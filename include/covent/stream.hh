@@ -0,0 +1,197 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_STREAM_HH
+#define COVENT_STREAM_HH
+
+#include <coroutine>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace covent::detail {
+
+  // growable FIFO on a circular buffer; doesn't allocate once it has
+  // grown to the steady state size
+  template<typename T>
+  class ring_queue {
+    protected:
+      std::vector<T> items;
+      std::size_t head = 0;
+      std::size_t count = 0;
+
+    public:
+      bool empty() const noexcept {
+        return count == 0;
+      }
+
+      std::size_t size() const noexcept {
+        return count;
+      }
+
+      void push(T item) {
+        if (count == items.size()) {
+          std::vector<T> grown(items.empty() ? 16 : 2 * items.size());
+          for (std::size_t i = 0; i < count; ++i)
+            grown[i] = std::move(items[(head + i) % items.size()]);
+          items = std::move(grown);
+          head = 0;
+        }
+        items[(head + count++) % items.size()] = std::move(item);
+      }
+
+      T pop() {
+        T item = std::move(items[head]);
+        head = (head + 1) % items.size();
+        --count;
+        return item;
+      }
+  };
+
+  // Producing side of an event_stream, implemented by the event loops
+  // on top of operations that complete many times.
+  template<typename T>
+  class event_stream_impl {
+    protected:
+      std::coroutine_handle<> waiter = nullptr;
+      ring_queue<T> results;
+
+      // once this many results are buffered the stream is paused until
+      // the consumer caught up to half of it
+      std::size_t capacity;
+      bool paused = false;
+
+      // buffer a result and wake up the consumer; needs to be the last
+      // thing done since the consumer might destroy the stream
+      void push(T res) {
+        results.push(std::move(res));
+
+        if (!paused && results.size() >= capacity) {
+          paused = true;
+          stop();
+        }
+
+        if (waiter != nullptr)
+          std::exchange(waiter, nullptr).resume();
+      }
+
+    public:
+      event_stream_impl(std::size_t c) : capacity(c > 0 ? c : 1) {
+        /* nothing to do here */
+      }
+
+      virtual ~event_stream_impl() = default;
+
+      bool await_ready() {
+        if (!results.empty())
+          return true;
+
+        // nothing buffered: make sure something is going to be produced
+        paused = false;
+        if (!active())
+          start();
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> c) {
+        waiter = c;
+      }
+
+      T await_resume() {
+        auto res = results.pop();
+
+        if (paused && results.size() <= capacity / 2) {
+          paused = false;
+          if (!active())
+            start();
+        }
+
+        return res;
+      }
+
+      // start producing results, stop producing them, and whether an
+      // operation is still pending
+      virtual void start() = 0;
+      virtual void stop() = 0;
+      virtual bool active() const = 0;
+  };
+
+}
+
+namespace covent {
+
+  // handle to a long running operation producing a result after the
+  // other; results are buffered while nobody is waiting for them
+  template<typename T>
+  class event_stream {
+    protected:
+      detail::event_stream_impl<T>* impl;
+
+    public:
+      class awaiter {
+        protected:
+          detail::event_stream_impl<T>* impl;
+
+        public:
+          awaiter(detail::event_stream_impl<T>* i) noexcept : impl(i) {
+            /* nothing to do here */
+          }
+
+          bool await_ready() {
+            return impl->await_ready();
+          }
+
+          void await_suspend(std::coroutine_handle<> c) {
+            impl->await_suspend(c);
+          }
+
+          T await_resume() {
+            return impl->await_resume();
+          }
+      };
+
+      explicit event_stream(detail::event_stream_impl<T>* i) noexcept
+        : impl(i) {
+        /* nothing to do here */
+      }
+
+      event_stream(event_stream&& other) noexcept
+        : impl(std::exchange(other.impl, nullptr)) {
+        /* nothing to do here */
+      }
+
+      event_stream& operator=(event_stream&& other) noexcept {
+        if (&other != this) {
+          delete impl;
+          impl = std::exchange(other.impl, nullptr);
+        }
+        return *this;
+      }
+
+      ~event_stream() {
+        delete impl;
+      }
+
+      // not copyable
+      event_stream(const event_stream&) = delete;
+      event_stream& operator=(const event_stream&) = delete;
+
+      awaiter next() const noexcept {
+        return { impl };
+      }
+  };
+
+}
+
+#endif
@@ -0,0 +1,284 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_SYNC_HH
+#define COVENT_SYNC_HH
+
+#include <covent/parking.hh>
+#include <covent/task.hh>
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <mutex>
+
+namespace covent::detail {
+
+  // awaiter parking the coroutine until Primitive::try_acquire() or
+  // whatever Try names succeeds
+  template<typename Primitive, bool (Primitive::*Try)() noexcept>
+  class parking_awaiter : public parked_waiter {
+    protected:
+      Primitive& prim;
+
+    public:
+      parking_awaiter(Primitive& p) noexcept : prim(p) {
+        /* nothing to do here */
+      }
+
+      bool attempt() {
+        return (prim.*Try)();
+      }
+
+      bool await_ready() noexcept {
+        return (prim.*Try)();
+      }
+
+      void await_suspend(std::coroutine_handle<> c) {
+        suspend(c);
+        prim.lot.park(this);
+        prim.lot.settle([this]() { return prim.available(); });
+      }
+
+      void await_resume() const noexcept {
+        /* nothing to do here */
+      }
+  };
+
+}
+
+namespace covent {
+
+  // Synchronization of coroutines that suspends instead of blocking
+  // the thread. Waiting coroutines park a node living in their awaiter,
+  // so nothing gets allocated and an uncontended acquire is a single
+  // atomic operation, none at all with local_sync. Coroutines are woken
+  // on the loop they suspended on.
+  //
+  // With atomic_sync the primitives may be shared between loops, with
+  // local_sync only between coroutines on the same one. Waiters can't
+  // be cancelled and the primitive has to outlive them.
+
+  template<typename Sync>
+  class basic_async_mutex {
+    template<typename P, bool (P::*)() noexcept>
+    friend class detail::parking_awaiter;
+
+    protected:
+      typename Sync::template cell<bool> locked = false;
+      detail::parking_lot<Sync> lot;
+
+      bool available() const noexcept {
+        return !locked.load(std::memory_order_relaxed);
+      }
+
+    public:
+      bool try_lock() noexcept {
+        return !locked.exchange(true, std::memory_order_acquire);
+      }
+
+      using lock_awaiter =
+        detail::parking_awaiter<basic_async_mutex, &basic_async_mutex::try_lock>;
+
+      // yields a guard owning the lock
+      class scoped_lock_awaiter : public lock_awaiter {
+        public:
+          using lock_awaiter::lock_awaiter;
+
+          std::unique_lock<basic_async_mutex> await_resume() const noexcept {
+            return { this->prim, std::adopt_lock };
+          }
+      };
+
+      basic_async_mutex() noexcept = default;
+
+      // not copyable
+      basic_async_mutex(const basic_async_mutex&) = delete;
+      basic_async_mutex& operator=(const basic_async_mutex&) = delete;
+
+      // co_await to lock
+      lock_awaiter lock() noexcept {
+        return { *this };
+      }
+
+      // co_await to lock; yields a guard unlocking when it goes away
+      scoped_lock_awaiter scoped_lock() noexcept {
+        return { *this };
+      }
+
+      // Waiters are handed the mutex in the order they arrived in, but
+      // coroutines locking in the meantime get ahead of them.
+      void unlock() {
+        locked.store(false, std::memory_order_release);
+        lot.notify([this]() { return available(); });
+      }
+  };
+
+  template<typename Sync>
+  class basic_async_semaphore {
+    template<typename P, bool (P::*)() noexcept>
+    friend class detail::parking_awaiter;
+
+    protected:
+      typename Sync::template cell<std::ptrdiff_t> count;
+      detail::parking_lot<Sync> lot;
+
+      bool available() const noexcept {
+        return count.load(std::memory_order_relaxed) > 0;
+      }
+
+    public:
+      bool try_acquire() noexcept {
+        auto c = count.load(std::memory_order_relaxed);
+        while (c > 0) {
+          if (count.compare_exchange_weak(c, c - 1,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed))
+            return true;
+        }
+        return false;
+      }
+
+      using acquire_awaiter =
+        detail::parking_awaiter<basic_async_semaphore,
+                                &basic_async_semaphore::try_acquire>;
+
+      explicit basic_async_semaphore(std::ptrdiff_t initial) noexcept
+        : count(initial) {
+        /* nothing to do here */
+      }
+
+      // not copyable
+      basic_async_semaphore(const basic_async_semaphore&) = delete;
+      basic_async_semaphore& operator=(const basic_async_semaphore&) = delete;
+
+      // co_await to take one unit
+      acquire_awaiter acquire() noexcept {
+        return { *this };
+      }
+
+      void release(std::ptrdiff_t n = 1) {
+        count.fetch_add(n, std::memory_order_release);
+        lot.notify([this]() { return available(); });
+      }
+
+      std::ptrdiff_t value() const noexcept {
+        return count.load(std::memory_order_relaxed);
+      }
+  };
+
+  template<typename Sync>
+  class basic_async_manual_reset_event {
+    template<typename P, bool (P::*)() noexcept>
+    friend class detail::parking_awaiter;
+
+    protected:
+      typename Sync::template cell<bool> state;
+      detail::parking_lot<Sync> lot;
+
+      bool available() const noexcept {
+        return state.load(std::memory_order_relaxed);
+      }
+
+    public:
+      bool is_set() noexcept {
+        return state.load(std::memory_order_acquire);
+      }
+
+      using wait_awaiter =
+        detail::parking_awaiter<basic_async_manual_reset_event,
+                                &basic_async_manual_reset_event::is_set>;
+
+      explicit basic_async_manual_reset_event(bool initial = false) noexcept
+        : state(initial) {
+        /* nothing to do here */
+      }
+
+      // not copyable
+      basic_async_manual_reset_event(const basic_async_manual_reset_event&) = delete;
+      basic_async_manual_reset_event& operator=(const basic_async_manual_reset_event&) = delete;
+
+      // co_await to wait until the event is set
+      wait_awaiter wait() noexcept {
+        return { *this };
+      }
+
+      // resumes all waiters
+      void set() {
+        state.store(true, std::memory_order_release);
+        lot.notify([this]() { return available(); });
+      }
+
+      void reset() noexcept {
+        state.store(false, std::memory_order_relaxed);
+      }
+  };
+
+  template<typename Sync>
+  class basic_async_latch {
+    template<typename P, bool (P::*)() noexcept>
+    friend class detail::parking_awaiter;
+
+    protected:
+      typename Sync::template cell<std::ptrdiff_t> count;
+      detail::parking_lot<Sync> lot;
+
+      bool available() const noexcept {
+        return count.load(std::memory_order_relaxed) <= 0;
+      }
+
+    public:
+      bool try_wait() noexcept {
+        return count.load(std::memory_order_acquire) <= 0;
+      }
+
+      using wait_awaiter =
+        detail::parking_awaiter<basic_async_latch, &basic_async_latch::try_wait>;
+
+      explicit basic_async_latch(std::ptrdiff_t expected) noexcept
+        : count(expected) {
+        /* nothing to do here */
+      }
+
+      // not copyable
+      basic_async_latch(const basic_async_latch&) = delete;
+      basic_async_latch& operator=(const basic_async_latch&) = delete;
+
+      // co_await to wait until the counter reached zero
+      wait_awaiter wait() noexcept {
+        return { *this };
+      }
+
+      // resumes all waiters once the counter reaches zero
+      void count_down(std::ptrdiff_t n = 1) {
+        if (count.fetch_sub(n, std::memory_order_acq_rel) - n <= 0)
+          lot.notify([this]() { return available(); });
+      }
+  };
+
+  // shared between loops
+  using async_mutex = basic_async_mutex<detail::atomic_sync>;
+  using async_semaphore = basic_async_semaphore<detail::atomic_sync>;
+  using async_manual_reset_event = basic_async_manual_reset_event<detail::atomic_sync>;
+  using async_latch = basic_async_latch<detail::atomic_sync>;
+
+  // only used by coroutines on a single loop; without atomic operations
+  using local_async_mutex = basic_async_mutex<detail::local_sync>;
+  using local_async_semaphore = basic_async_semaphore<detail::local_sync>;
+  using local_async_manual_reset_event = basic_async_manual_reset_event<detail::local_sync>;
+  using local_async_latch = basic_async_latch<detail::local_sync>;
+
+}
+
+#endif
@@ -16,29 +16,126 @@
 #define COVENT_TASK_HH
 
 #include <covent/base.hh>
+#include <covent/cancel.hh>
+#include <covent/chain.hh>
+#include <covent/evloops.hh>
 #include <covent/exceptions.hh>
 
 #include <atomic>
+#include <chrono>
+#include <concepts>
 #include <coroutine>
+#include <exception>
 #include <memory>
+#include <type_traits>
+#include <utility>
 
 #include <iostream>
 
+namespace covent::detail {
+
+  // Stand-in for std::atomic with the same interface, for state only
+  // ever touched by a single thread. Memory orders are ignored.
+  template<typename T>
+  class plain_cell {
+    protected:
+      T value;
+
+    public:
+      constexpr plain_cell(T v) noexcept : value(v) {
+        /* nothing to do here */
+      }
+
+      T load(std::memory_order = std::memory_order_seq_cst) const noexcept {
+        return value;
+      }
+
+      void store(T v, std::memory_order = std::memory_order_seq_cst) noexcept {
+        value = v;
+      }
+
+      T exchange(T v, std::memory_order = std::memory_order_seq_cst) noexcept {
+        return std::exchange(value, v);
+      }
+
+      bool compare_exchange_strong(T& expected, T desired,
+                                   std::memory_order = std::memory_order_seq_cst,
+                                   std::memory_order = std::memory_order_seq_cst) noexcept {
+        if (value != expected) {
+          expected = value;
+          return false;
+        }
+        value = desired;
+        return true;
+      }
+
+      bool compare_exchange_weak(T& expected, T desired,
+                                 std::memory_order s = std::memory_order_seq_cst,
+                                 std::memory_order f = std::memory_order_seq_cst) noexcept {
+        return compare_exchange_strong(expected, desired, s, f);
+      }
+
+      T fetch_add(T v, std::memory_order = std::memory_order_seq_cst) noexcept {
+        return std::exchange(value, value + v);
+      }
+
+      T fetch_sub(T v, std::memory_order = std::memory_order_seq_cst) noexcept {
+        return std::exchange(value, value - v);
+      }
+  };
+
+  // how the reference count and waiter list of a task are shared
+  struct atomic_sync {
+      template<typename T>
+      using cell = std::atomic<T>;
+
+      static void fence() noexcept {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+      }
+  };
+
+  struct local_sync {
+      template<typename T>
+      using cell = plain_cell<T>;
+
+      static void fence() noexcept {
+        /* nothing to do here */
+      }
+  };
+
+}
+
 namespace covent {
 
-  template<typename>
-  class task;
+  template<typename, typename>
+  class basic_task;
+
+  // task that may be awaited from any thread
+  template<typename ResultType = void>
+  using task = basic_task<ResultType, detail::atomic_sync>;
+
+  // Task that is created, awaited and destroyed on the thread of a
+  // single loop only. Does without atomic operations.
+  template<typename ResultType = void>
+  using local_task = basic_task<ResultType, detail::local_sync>;
 
 }
 
 namespace covent::detail {
 
-  struct waiter_list {
-      std::coroutine_handle<> continuation;
-      waiter_list* next;
-  };
+  class group_child;
 
-  // ...
+  template<typename>
+  class group_child_of;
+
+  // Report a task of a group as finished. Returns the coroutine to
+  // resume next, if any. The task may be gone afterwards.
+  std::coroutine_handle<> child_finished(group_child*, std::exception_ptr) noexcept;
+
+  // Hands over to the coroutines waiting for the task: the single
+  // waiter usual for task chains is resumed by symmetric transfer,
+  // keeping the stack depth constant. With more waiters all but the
+  // first to arrive go through the ready queue of the loop.
   class final_awaiter {
     public:
       bool await_ready() const noexcept {
@@ -50,8 +147,11 @@ namespace covent::detail {
       }
 
       template<typename PromiseType>
-      void await_suspend(std::coroutine_handle<PromiseType> coro) noexcept {
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<PromiseType> coro) noexcept {
         auto& prms = coro.promise();
+        auto loop = prms.loop;
+        auto child = prms.child;
 
         // exchange operation needs to be 'release' so that subsequent
         // awaiters have visibility of the result. Also needs to be
@@ -60,20 +160,69 @@ namespace covent::detail {
           prms.state_ready, std::memory_order_acq_rel
         );
 
-        if (waiters == nullptr)
-          return;
-
+        // the list is in reverse order of arrival; the promise may be
+        // gone as soon as the first waiter runs
         waiter_list* waiter = static_cast<waiter_list*>(waiters);
         waiter_list* next;
 
-        while ((next = waiter->next) != nullptr) {
-          waiter->continuation.resume();
+        if (child == nullptr) {
+          if (waiter == nullptr)
+            return std::noop_coroutine();
+
+          while ((next = waiter->next) != nullptr) {
+            if (loop != nullptr)
+              loop->schedule(waiter);
+            else
+              waiter->continuation.resume();
+            waiter = next;
+          }
+
+          return waiter->continuation;
+        }
+
+        // tasks running in a group hand over to the group's waiter if
+        // they are the last one to finish; it may release the task, so
+        // all waiters go through the ready queue
+        auto group_next = child_finished(child, prms.exception);
+
+        while (waiter != nullptr) {
+          next = waiter->next;
+          if (loop != nullptr)
+            loop->schedule(waiter);
+          else
+            waiter->continuation.resume();
           waiter = next;
         }
 
-        // resume last waiter at the very end to allow it to potentially
-        // be compiled as a tail-call
-        waiter->continuation.resume();
+        return group_next ? group_next : std::noop_coroutine();
+      }
+  };
+
+  // Forwards to an awaiter switching threads and afterwards points the
+  // promise at the loop running the thread it resumed on.
+  template<typename Awaiter>
+  class rebind_awaiter {
+    protected:
+      Awaiter aw;
+      evloop_base*& loop;
+
+    public:
+      rebind_awaiter(Awaiter&& a, evloop_base*& l) noexcept
+        : aw(std::forward<Awaiter>(a)), loop(l) {
+        /* nothing to do here */
+      }
+
+      bool await_ready() {
+        return aw.await_ready();
+      }
+
+      decltype(auto) await_suspend(std::coroutine_handle<> c) {
+        return aw.await_suspend(c);
+      }
+
+      decltype(auto) await_resume() {
+        loop = find_active_loop();
+        return aw.await_resume();
       }
   };
 
@@ -95,33 +244,45 @@ namespace covent::detail {
         return coro == nullptr || coro.promise().done();
       }
 
-      bool await_suspend(std::coroutine_handle<> awaiter) noexcept {
+      std::coroutine_handle<>
+      await_suspend(std::coroutine_handle<> awaiter) noexcept {
         waiter.continuation = awaiter;
+        waiter.next = nullptr;
 
         auto& prms = coro.promise();
         auto& waiters = prms.waiters;
         auto wtr = &waiter;
         auto old = waiters.load(std::memory_order_acquire);
 
-        // if coro not already started: set waiters to nullptr indicates
-        // that it's now running but has no waiters yet
+        // if coro not already started: register as its only waiter and
+        // transfer control to it, it'll transfer back when done
         if (old == prms.state_not_started &&
-            waiters.compare_exchange_strong(old, nullptr, std::memory_order_relaxed)) {
-          coro.resume();
-          old = waiters.load(std::memory_order_acquire);
-        }
+            waiters.compare_exchange_strong(old, wtr, std::memory_order_release,
+                                            std::memory_order_acquire))
+          return coro;
 
         // enqueue the waiter into the list of waiting coroutines
         while (true) {
           if (old == prms.state_ready)
-            return false;
+            return awaiter;
           wtr->next = static_cast<waiter_list*>(old);
           if (waiters.compare_exchange_weak(
                 old, wtr, std::memory_order_release, std::memory_order_acquire))
             break;
         }
 
-        return true;
+        return std::noop_coroutine();
+      }
+
+      // tasks awaited before they started run with the cancellation
+      // token of the awaiting one
+      void inherit(cancellation_token* token) noexcept {
+        if (token == nullptr || coro == nullptr)
+          return;
+        auto& prms = coro.promise();
+        if (prms.token == nullptr &&
+            prms.waiters.load(std::memory_order_relaxed) == prms.state_not_started)
+          prms.token = token;
       }
 
       decltype(auto) await_resume() requires (!SynchronizeOnly) {
@@ -138,12 +299,23 @@ namespace covent::detail {
     friend TaskType;
     friend class final_awaiter;
     template<typename, bool> friend class task_awaiter;
+    template<typename> friend class group_child_of;
 
     protected:
-      std::atomic<std::uint32_t> refcnt;
-      std::atomic<void*> waiters;
+      using sync = typename TaskType::sync_type;
+      using factory = awaiter_factory<loop_type>;
+
+      typename sync::template cell<std::uint32_t> refcnt;
+      typename sync::template cell<void*> waiters;
       std::exception_ptr exception;
-      detail::evloop_base& loop;
+      // nullptr while running on a thread without a loop
+      detail::evloop_base* loop;
+
+      // events are awaited with this token unless given one explicitly
+      cancellation_token* token = nullptr;
+
+      // set while running in a task group
+      group_child* child = nullptr;
 
       // indicates value is ready
       void* const state_ready = this;
@@ -156,10 +328,18 @@ namespace covent::detail {
         : refcnt(1),
           waiters(&waiters),
           exception(nullptr),
-          loop(get_active_loop()) {
+          loop(find_active_loop()) {
         /* nothing to do here */
       }
 
+      static void* operator new(std::size_t size) {
+        return allocate_frame(size);
+      }
+
+      static void operator delete(void* ptr, std::size_t size) noexcept {
+        deallocate_frame(ptr, size);
+      }
+
       TaskType get_return_object() noexcept {
         return TaskType(
           TaskType::handle_type::from_promise(
@@ -184,14 +364,86 @@ namespace covent::detail {
         return waiters.load(std::memory_order_acquire) == state_ready;
       }
 
-      template<typename R>
-      auto await_transform(covent::task<R>& tsk) const noexcept {
-        return tsk.operator co_await();
+      template<typename R, typename S>
+      auto await_transform(covent::basic_task<R, S>& tsk) const noexcept {
+        auto aw = tsk.operator co_await();
+        aw.inherit(token);
+        return aw;
+      }
+
+      // temporaries live until the end of the full co_await expression
+      template<typename R, typename S>
+      auto await_transform(covent::basic_task<R, S>&& tsk) const noexcept {
+        auto aw = tsk.operator co_await();
+        aw.inherit(token);
+        return aw;
+      }
+
+      // Events are awaited through awaiters of the loop type, created
+      // right in the frame of the coroutine.
+      template<typename Op>
+      auto await_transform(op_request<Op> req) const noexcept {
+        return request_awaiter {
+          [&]() { return factory::create(*loop, std::move(req.op)); },
+          req.token != nullptr ? req.token : token, req.timeout
+        };
+      }
+
+      // chains are handed to the loop as a whole, as event_awaiters
+      template<typename ...Ops>
+      chain_awaiter<sizeof...(Ops)> await_transform(op_chain<Ops...> c) const {
+        return {
+          *loop,
+          [&]() {
+            return std::apply([&](Ops& ...ops) {
+              return std::array<event_awaiter, sizeof...(Ops)> {
+                loop->create_event_awaiter(std::move(ops))...
+              };
+            }, c.ops);
+          },
+          c.hard
+        };
+      }
+
+      auto await_transform(periodic& p) const noexcept {
+        return request_awaiter {
+          [&]() { return factory::create(*loop, p.next()); },
+          token, std::chrono::nanoseconds::max()
+        };
       }
 
       template<typename ...Args>
-      event_awaiter await_transform(Args... args) const noexcept {
-        return loop.create_event_awaiter(std::forward<Args>(args)...);
+        requires requires (evloop_base& l, Args... args) {
+          l.create_event_awaiter(std::move(args)...);
+        }
+      auto await_transform(Args... args) const noexcept {
+        return request_awaiter {
+          [&]() { return factory::create(*loop, std::forward<Args>(args)...); },
+          token, std::chrono::nanoseconds::max()
+        };
+      }
+
+      template<typename Awaiter>
+        requires std::derived_from<std::remove_cvref_t<Awaiter>, loop_hop>
+      rebind_awaiter<Awaiter> await_transform(Awaiter&& aw) noexcept {
+        return { std::forward<Awaiter>(aw), loop };
+      }
+
+      // awaiters passing cancellation on to what they wait for
+      template<typename Awaiter>
+        requires requires (Awaiter& aw, cancellation_token* t) { aw.bind_token(t); }
+      Awaiter&& await_transform(Awaiter&& aw) const noexcept {
+        aw.bind_token(token);
+        return std::forward<Awaiter>(aw);
+      }
+
+      // everything that already is an awaiter is awaited as is
+      template<typename Awaiter>
+        requires requires (Awaiter aw) { aw.await_ready(); } &&
+                 (!std::derived_from<std::remove_cvref_t<Awaiter>, loop_hop>) &&
+                 (!requires (Awaiter& aw, cancellation_token* t) { aw.bind_token(t); })
+      Awaiter&& await_transform(Awaiter&& aw) const noexcept {
+        return std::forward<Awaiter>(aw);
       }
   };
 
@@ -271,17 +523,22 @@ namespace covent {
 
   // ...
   template<
-    typename ResultType = void
+    typename ResultType,
+    typename Sync
   >
-  class [[nodiscard]] task {
-    template<typename R>
-    friend bool operator==(const task<R>&, const task<R>&) noexcept;
+  class [[nodiscard]] basic_task {
+    template<typename R, typename S>
+    friend bool operator==(const basic_task<R, S>&, const basic_task<R, S>&) noexcept;
+
+    template<typename R, typename S>
+    friend bool operator!=(const basic_task<R, S>&, const basic_task<R, S>&) noexcept;
 
-    template<typename R>
-    friend bool operator!=(const task<R>&, const task<R>&) noexcept;
+    template<typename>
+    friend class detail::group_child_of;
 
     public:
-      using promise_type = detail::promise<task, ResultType>;
+      using sync_type = Sync;
+      using promise_type = detail::promise<basic_task, ResultType>;
       using handle_type = std::coroutine_handle<promise_type>;
 
     protected:
@@ -293,30 +550,30 @@ namespace covent {
       }
 
     public:
-      task() noexcept : coro(nullptr) {
+      basic_task() noexcept : coro(nullptr) {
         /* nothing to do here */
       }
 
-      explicit task(handle_type c) : coro(c) {
+      explicit basic_task(handle_type c) : coro(c) {
         // don't increment the ref-count here since it has already been
         // initialised to 2 (one for task and one for coroutine) in the
         // task_promise constructor
       }
 
-      task(task&& other) noexcept : coro(other.coro) {
+      basic_task(basic_task&& other) noexcept : coro(other.coro) {
         other.coro = nullptr;
       }
 
-      task(const task& other) noexcept : coro(other.coro) {
+      basic_task(const basic_task& other) noexcept : coro(other.coro) {
         if (coro)
           coro.promise().refcnt.fetch_add(1, std::memory_order_relaxed);
       }
 
-      ~task() {
+      ~basic_task() {
         destroy();
       }
 
-      task& operator=(task&& other) noexcept {
+      basic_task& operator=(basic_task&& other) noexcept {
         if (&other != this) {
           destroy();
           coro = other.coro;
@@ -325,7 +582,7 @@ namespace covent {
         return *this;
       }
 
-      task& operator=(const task& other) noexcept {
+      basic_task& operator=(const basic_task& other) noexcept {
         if (coro != other.coro) {
           destroy();
           coro = other.coro;
@@ -356,13 +613,13 @@ namespace covent {
       }
   };
 
-  template<typename R>
-  bool operator==(const task<R>& lhs, const task<R>& rhs) noexcept {
+  template<typename R, typename S>
+  bool operator==(const basic_task<R, S>& lhs, const basic_task<R, S>& rhs) noexcept {
     return lhs.coro == rhs.coro;
   }
 
-  template<typename R>
-  bool operator!=(const task<R>& lhs, const task<R>& rhs) noexcept {
+  template<typename R, typename S>
+  bool operator!=(const basic_task<R, S>& lhs, const basic_task<R, S>& rhs) noexcept {
     return lhs.coro != rhs.coro;
   }
 
@@ -15,8 +15,260 @@
 #ifndef COVENT_TASKGRP_HH
 #define COVENT_TASKGRP_HH
 
+#include <covent/base.hh>
+#include <covent/cancel.hh>
+#include <covent/task.hh>
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
 namespace covent {
 
+  class task_group;
+
+}
+
+namespace covent::detail {
+
+  // bookkeeping of a task running in a group; outlives the group if
+  // the task is still running when the group goes away
+  class group_child {
+    public:
+      task_group* group;
+      std::size_t index;
+      cancellation_token token;
+      bool done = false;
+
+      group_child(task_group& g, std::size_t i) noexcept
+        : group(&g), index(i) {
+        /* nothing to do here */
+      }
+
+      virtual ~group_child() = default;
+  };
+
+  template<typename Task>
+  class group_child_of final : public group_child {
+    public:
+      Task task;
+
+      group_child_of(task_group& g, std::size_t i, Task&& t) noexcept
+        : group_child(g, i), task(std::move(t)) {
+        /* nothing to do here */
+      }
+
+      // start the task unless it already runs; false if it's done
+      bool start() {
+        if (task.done())
+          return false;
+
+        auto& prms = task.coro.promise();
+        prms.child = this;
+        prms.token = &token;
+
+        auto old = prms.state_not_started;
+        if (prms.waiters.compare_exchange_strong(old, nullptr,
+                                                 std::memory_order_relaxed))
+          task.coro.resume();
+        return true;
+      }
+  };
+
+  // element type of the results of when_all
+  template<typename R>
+  struct group_result {
+      using type = R;
+  };
+
+  template<>
+  struct group_result<void> {
+      using type = std::monostate;
+  };
+
+  template<typename R, typename S>
+  typename group_result<R>::type result_of(basic_task<R, S>& tsk) {
+    if constexpr (std::is_void_v<R>) {
+      tsk.result();
+      return {};
+    }
+    else
+      return tsk.result();
+  }
+
+}
+
+namespace covent {
+
+  // Runs tasks concurrently, starting each one right away. Awaiting
+  // wait() suspends until all of them finished, counting them down
+  // rather than waiting on each, and rethrows the first exception that
+  // escaped one of them; the others are cancelled then. Cancelling
+  // reaches the events the tasks await, including those of the tasks
+  // they await in turn, and comes from cancel() as well as the token of
+  // the task awaiting wait().
+  //
+  // A group and its tasks belong to the thread of a single loop. Tasks
+  // still running when the group goes away are cancelled and left to
+  // finish on their own.
+  class task_group : protected detail::cancel_listener {
+    friend std::coroutine_handle<>
+    detail::child_finished(detail::group_child*, std::exception_ptr) noexcept;
+
+    public:
+      static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+      class wait_awaiter {
+        protected:
+          task_group& group;
+          cancellation_token* parent = nullptr;
+
+        public:
+          wait_awaiter(task_group& g) noexcept : group(g) {
+            /* nothing to do here */
+          }
+
+          ~wait_awaiter();
+
+          void bind_token(cancellation_token* t) noexcept {
+            parent = t;
+          }
+
+          bool await_ready() const noexcept {
+            return group.running == 0;
+          }
+
+          void await_suspend(std::coroutine_handle<>);
+          void await_resume();
+      };
+
+    protected:
+      std::vector<std::unique_ptr<detail::group_child>> children;
+      std::size_t running = 0;
+      std::size_t first = npos;
+      std::exception_ptr error;
+
+      std::coroutine_handle<> waiting = nullptr;
+      detail::waiter_list wake_node;
+
+      // cancellation queued up by a finishing task
+      struct cancel_node : detail::waiter_list {
+          task_group* group;
+      } deferred_cancel;
+      detail::evloop_base* cancel_loop = nullptr;
+
+      bool race;
+      bool cancelled = false;
+      bool cancelling = false;
+
+      std::coroutine_handle<> finished(detail::group_child&, std::exception_ptr) noexcept;
+      void cancel_children();
+      void defer_cancel() noexcept;
+      std::coroutine_handle<> wake() noexcept;
+      void on_cancel();
+
+    public:
+      // With race set the first task to finish cancels the others and
+      // only its exception is rethrown.
+      explicit task_group(bool race = false) noexcept;
+      ~task_group();
+
+      // not copyable
+      task_group(const task_group&) = delete;
+      task_group& operator=(const task_group&) = delete;
+
+      template<typename R, typename S>
+      void spawn(basic_task<R, S> tsk) {
+        auto child = std::make_unique<detail::group_child_of<basic_task<R, S>>>(
+          *this, children.size(), std::move(tsk)
+        );
+        auto& c = *child;
+        children.push_back(std::move(child));
+
+        if (cancelled)
+          c.token.cancel();
+
+        ++running;
+        if (!c.start()) {
+          c.done = true;
+          --running;
+        }
+      }
+
+      wait_awaiter wait() noexcept {
+        return { *this };
+      }
+
+      void cancel();
+
+      std::size_t size() const noexcept {
+        return children.size();
+      }
+
+      std::size_t active() const noexcept {
+        return running;
+      }
+
+      // index of the first task to finish, npos while none did
+      std::size_t first_finished() const noexcept {
+        return first;
+      }
+  };
+
+  // Run the tasks concurrently and return their results once all of
+  // them finished; void results show up as std::monostate.
+  template<typename ...R, typename ...S>
+  task<std::tuple<typename detail::group_result<R>::type...>>
+  when_all(basic_task<R, S> ...tasks) {
+    task_group group;
+    (group.spawn(tasks), ...);
+    co_await group.wait();
+    co_return std::tuple<typename detail::group_result<R>::type...> {
+      detail::result_of(tasks)...
+    };
+  }
+
+  template<typename R, typename S>
+  task<std::vector<typename detail::group_result<R>::type>>
+  when_all(std::vector<basic_task<R, S>> tasks) {
+    task_group group;
+    for (auto& t : tasks)
+      group.spawn(t);
+    co_await group.wait();
+
+    std::vector<typename detail::group_result<R>::type> results;
+    results.reserve(tasks.size());
+    for (auto& t : tasks)
+      results.push_back(detail::result_of(t));
+    co_return std::move(results);
+  }
+
+  // Run the tasks concurrently until the first one finished, cancel the
+  // others and return the index of the first one once all are done.
+  template<typename ...R, typename ...S>
+  task<std::size_t> when_any(basic_task<R, S> ...tasks) {
+    task_group group(true);
+    (group.spawn(tasks), ...);
+    co_await group.wait();
+    co_return group.first_finished();
+  }
+
+  template<typename R, typename S>
+  task<std::size_t> when_any(std::vector<basic_task<R, S>> tasks) {
+    task_group group(true);
+    for (auto& t : tasks)
+      group.spawn(t);
+    co_await group.wait();
+    co_return group.first_finished();
+  }
+
 }
 
 #endif
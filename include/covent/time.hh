@@ -0,0 +1,69 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_TIME_HH
+#define COVENT_TIME_HH
+
+#include <chrono>
+#include <ctime>
+#include <stdexcept>
+
+namespace covent {
+
+  // CLOCK_BOOTTIME: monotonic, but keeps counting during suspend
+  class boot_clock {
+    public:
+      using duration = std::chrono::nanoseconds;
+      using rep = duration::rep;
+      using period = duration::period;
+      using time_point = std::chrono::time_point<boot_clock>;
+
+      static constexpr bool is_steady = true;
+
+      static time_point now() noexcept {
+        timespec ts;
+        clock_gettime(CLOCK_BOOTTIME, &ts);
+        return time_point(
+          std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)
+        );
+      }
+  };
+
+  // Awaitable ticker. Deadlines advance by exactly one period per tick
+  // from the starting point, so they don't drift and no clock read is
+  // needed per tick. Ticks missed by a slow consumer fire back to back.
+  class periodic {
+    public:
+      using clock = std::chrono::steady_clock;
+
+    protected:
+      clock::duration interval;
+      clock::time_point deadline;
+
+    public:
+      periodic(clock::duration i, clock::time_point start = clock::now())
+        : interval(i), deadline(start) {
+        if (interval <= clock::duration::zero())
+          throw std::invalid_argument("periodic interval has to be positive");
+      }
+
+      // deadline of the next tick
+      clock::time_point next() noexcept {
+        return deadline += interval;
+      }
+  };
+
+}
+
+#endif
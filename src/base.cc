@@ -16,17 +16,16 @@
 #include <covent/base.hh>
 #include <covent/event_loop.hh>
 
+#include "frame_pool.hh"
 #include "impl.hh"
 
 namespace covent::detail {
 
-  event_awaiter::event_awaiter(event_awaiter_impl* i)
-    : impl(i) {
-    /* nothing to do here */
-  }
-
   event_awaiter::~event_awaiter() {
-    delete impl;
+    if (is_inline())
+      impl->~event_awaiter_impl();
+    else
+      delete impl;
   }
 
   bool event_awaiter::await_ready() {
@@ -38,8 +37,70 @@ namespace covent::detail {
     impl->await_suspend();
   }
 
-  void event_awaiter::await_resume() {
-    impl->await_resume();
+  int event_awaiter::await_resume() {
+    return impl->await_resume();
+  }
+
+  void event_awaiter::start() {
+    impl->start();
+  }
+
+  void event_awaiter::cancel() {
+    impl->cancel();
+  }
+
+  void event_awaiter::set_timeout(std::chrono::nanoseconds ns) {
+    impl->set_timeout(ns);
+  }
+
+
+  evloop_base::evloop_base(const event_loop_config& conf)
+    : ready_budget(conf.get<int, unsigned>("ready_budget", 256)),
+      self(std::make_shared<loop_handle>()) {
+    self->loop = this;
+    if (conf.get<bool>("frame_pool", false))
+      frames = new frame_pool(
+        stats, conf.get<int, std::size_t>("frame_pool_max_size", 4096)
+      );
+  }
+
+  evloop_base::~evloop_base() {
+    retire();
+    delete frames;
+  }
+
+  void evloop_base::retire() noexcept {
+    std::lock_guard lock(self->lock);
+    self->loop = nullptr;
+  }
+
+  unsigned evloop_base::run_ready() {
+    // only what's queued right now, so coroutines requeueing themselves
+    // don't keep the loop from getting back to the ring
+    auto tail = ready_tail;
+    unsigned resumed = 0;
+
+    while (ready_head != nullptr && resumed < ready_budget) {
+      auto w = ready_head;
+      ready_head = w->next;
+      if (ready_head == nullptr)
+        ready_tail = &ready_head;
+      ++resumed;
+
+      // the node is gone once its coroutine runs
+      auto last = &w->next == tail;
+      if (w->callback != nullptr)
+        w->callback(w);
+      else
+        w->continuation.resume();
+      if (last)
+        break;
+    }
+
+    stats.ready_resumed += resumed;
+    if (ready_head != nullptr)
+      ++stats.ready_deferred;
+    return resumed;
   }
 
 
@@ -55,6 +116,47 @@ namespace covent::detail {
     return *active_loop;
   }
 
+  evloop_base* find_active_loop() noexcept {
+    return active_loop;
+  }
+
+
+  // every frame is prefixed by a header recording the pool it came
+  // from, so it can be returned there no matter which loop is active,
+  // if any, when it gets destroyed
+  constexpr std::size_t frame_header_size =
+    __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+  static_assert(sizeof(frame_pool*) <= frame_header_size);
+
+  void* allocate_frame(std::size_t size) {
+    size += frame_header_size;
+
+    frame_pool* pool = active_loop ? active_loop->frames : nullptr;
+    void* mem = pool ? pool->allocate(size) : nullptr;
+
+    if (mem == nullptr) {
+      pool = nullptr;
+      mem = ::operator new(size);
+    }
+
+    *static_cast<frame_pool**>(mem) = pool;
+    return static_cast<std::byte*>(mem) + frame_header_size;
+  }
+
+  void deallocate_frame(void* ptr, std::size_t size) noexcept {
+    void* mem = static_cast<std::byte*>(ptr) - frame_header_size;
+
+    auto pool = *static_cast<frame_pool**>(mem);
+    if (pool == nullptr)
+      ::operator delete(mem);
+    // only the thread running the loop may touch its free lists
+    else if (active_loop != nullptr && active_loop->frames == pool)
+      pool->deallocate(mem, size + frame_header_size);
+    else
+      pool->give_back(mem, size + frame_header_size);
+  }
+
 }
 
 namespace covent {
@@ -64,4 +166,9 @@ namespace covent {
     return loop;
   }
 
+  buffer_group::buffer_group(unsigned count, std::size_t size)
+    : impl(detail::get_active_loop().create_buffer_group(count, size)) {
+    /* nothing to do here */
+  }
+
 }
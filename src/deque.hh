@@ -0,0 +1,145 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_DEQUE_HH
+#define COVENT_DEQUE_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace covent::detail {
+
+  // Chase-Lev work-stealing deque of pointers, following Lê et al.,
+  // "Correct and Efficient Work-Stealing for Weak Memory Models". The
+  // owning thread pushes and takes at the bottom, any other thread
+  // steals from the top. Grows as needed; arrays it outgrew are kept
+  // until destruction since thieves may still be reading them.
+  class ws_deque {
+    protected:
+      struct array {
+          std::int64_t mask;
+          std::unique_ptr<std::atomic<void*>[]> slots;
+
+          array(std::int64_t size)
+            : mask(size - 1), slots(new std::atomic<void*>[size]) {
+            /* nothing to do here */
+          }
+
+          void* get(std::int64_t i) const noexcept {
+            return slots[i & mask].load(std::memory_order_relaxed);
+          }
+
+          void put(std::int64_t i, void* p) noexcept {
+            slots[i & mask].store(p, std::memory_order_relaxed);
+          }
+      };
+
+      alignas(64) std::atomic<std::int64_t> top = 0;
+      alignas(64) std::atomic<std::int64_t> bottom = 0;
+      std::atomic<array*> items;
+      std::vector<std::unique_ptr<array>> arrays;
+
+      array* grow(array* a, std::int64_t b, std::int64_t t) {
+        auto bigger = std::make_unique<array>(2 * (a->mask + 1));
+        for (auto i = t; i < b; ++i)
+          bigger->put(i, a->get(i));
+        auto* raw = bigger.get();
+        arrays.push_back(std::move(bigger));
+        items.store(raw, std::memory_order_release);
+        return raw;
+      }
+
+    public:
+      // initial capacity, has to be a power of two
+      explicit ws_deque(std::size_t capacity = 256) {
+        arrays.push_back(
+          std::make_unique<array>(static_cast<std::int64_t>(capacity))
+        );
+        items.store(arrays.back().get(), std::memory_order_relaxed);
+      }
+
+      // not copyable
+      ws_deque(const ws_deque&) = delete;
+      ws_deque& operator=(const ws_deque&) = delete;
+
+      // owner only
+      void push(void* p) {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        auto* a = items.load(std::memory_order_relaxed);
+        if (b - t > a->mask)
+          a = grow(a, b, t);
+        a->put(b, p);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+      }
+
+      // owner only; nullptr if empty
+      void* take() noexcept {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        auto* a = items.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+          bottom.store(b + 1, std::memory_order_relaxed);
+          return nullptr;
+        }
+
+        void* p = a->get(b);
+        if (t == b) {
+          // last item, race thieves for it
+          if (!top.compare_exchange_strong(t, t + 1,
+                                           std::memory_order_seq_cst,
+                                           std::memory_order_relaxed))
+            p = nullptr;
+          bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return p;
+      }
+
+      // any thread; nullptr if empty or lost a race with another thief
+      // or the owner
+      void* steal() noexcept {
+        auto t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+          return nullptr;
+
+        auto* a = items.load(std::memory_order_acquire);
+        void* p = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1,
+                                         std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+          return nullptr;
+        return p;
+      }
+
+      // approximate when called by other threads than the owner
+      std::size_t size() const noexcept {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_relaxed);
+        return b > t ? static_cast<std::size_t>(b - t) : 0;
+      }
+  };
+
+}
+
+#endif
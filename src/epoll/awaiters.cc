@@ -0,0 +1,350 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "awaiters.hh"
+#include "evloop.hh"
+
+#include <bit>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace covent::epoll {
+
+  using covent::detail::event_awaiter;
+  using covent::detail::timer_clock;
+
+  watcher::~watcher() {
+    loop.unwatch(this);
+  }
+
+
+  void operation_timer::expire() {
+    op.expire();
+  }
+
+
+  operation::operation(evloop& l, int f, std::uint32_t events)
+    : watcher(l) {
+    fd = f;
+    interest = events;
+  }
+
+  operation::~operation() {
+    if (timer != nullptr && timer->armed())
+      loop.cancel_timer(timer.get());
+  }
+
+  bool operation::await_ready() {
+    // calls that can't block are tried right away and skip suspending
+    // altogether if they don't have to wait
+    if (!started && !completed && (interest == 0 || eager()) && !tried)
+      try_attempt();
+    return completed;
+  }
+
+  void operation::await_suspend() {
+    if (!started)
+      start();
+  }
+
+  int operation::await_resume() {
+    return res;
+  }
+
+  void operation::start() {
+    started = true;
+
+    // cancelled while waiting for its turn in a chain
+    if (completed) {
+      finish(res);
+      return;
+    }
+
+    if (timer != nullptr)
+      loop.arm_timer(timer.get(), timer_clock::now() + timer->after);
+
+    if (interest == 0 || (eager() && !tried)) {
+      if (try_attempt())
+        return;
+    }
+
+    // epoll refuses descriptors that are always ready, e.g. regular
+    // files; they block instead
+    if (auto r = loop.watch(this); r == -EPERM) {
+      tried = true;
+      finish(attempt());
+    }
+    else if (r < 0)
+      finish(r);
+  }
+
+  bool operation::try_attempt() {
+    auto r = attempt();
+    tried = true;
+    if (r == -EAGAIN && interest != 0)
+      return false;
+    finish(r);
+    return true;
+  }
+
+  void operation::ready(std::uint32_t) {
+    tried = true;
+    if (auto r = attempt(); r != -EAGAIN) {
+      loop.unwatch(this);
+      finish(r);
+    }
+  }
+
+  void operation::finish(int r) {
+    if (timer != nullptr && timer->armed())
+      loop.cancel_timer(timer.get());
+    res = r;
+    completed = true;
+
+    // completed before it was started; nobody to tell yet
+    if (!started)
+      return;
+
+    // Start the rest of the chain, unless this failed without a hard
+    // link, which cancels the remaining operations like the kernel does.
+    if (chained != nullptr) {
+      if (r >= 0 || hard) {
+        chained->start();
+        return;
+      }
+      auto o = chained;
+      for (; o->chained != nullptr; o = o->chained) {
+        o->res = -ECANCELED;
+        o->completed = true;
+      }
+      o->finish(-ECANCELED);
+      return;
+    }
+
+    if (parent != nullptr)
+      loop.defer(parent);
+  }
+
+  void operation::cancel() {
+    if (completed)
+      return;
+    loop.unwatch(this);
+    finish(-ECANCELED);
+  }
+
+  void operation::expire() {
+    loop.unwatch(this);
+    finish(-ETIME);
+  }
+
+  void operation::set_timeout(std::chrono::nanoseconds ns) {
+    if (timer == nullptr)
+      timer = std::make_unique<operation_timer>(*this);
+    timer->after = ns;
+  }
+
+  void operation::chain(operation* next, bool h, std::coroutine_handle<> c) {
+    chained = next;
+    hard = h;
+    parent = c;
+    started = true;
+  }
+
+
+  buffer_pool::buffer_pool(unsigned count, std::size_t sz)
+    : size(sz) {
+    if (count == 0 || count > 32768 || !std::has_single_bit(count))
+      throw std::invalid_argument(
+        "buffer group size has to be a power of two up to 32768"
+      );
+    if (size == 0 || size > std::numeric_limits<int>::max())
+      throw std::invalid_argument("invalid buffer size");
+
+    // page aligned so the buffers don't share cache lines with anything
+    auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    memory = static_cast<std::byte*>(
+      std::aligned_alloc(page, (count * size + page - 1) / page * page)
+    );
+    if (memory == nullptr)
+      throw std::bad_alloc();
+
+    // handed out lowest id first
+    free_ids.reserve(count);
+    for (auto id = count; id > 0; --id)
+      free_ids.push_back(static_cast<std::uint16_t>(id - 1));
+  }
+
+  buffer_pool::~buffer_pool() {
+    std::free(memory);
+  }
+
+  int buffer_pool::take() noexcept {
+    if (free_ids.empty())
+      return -1;
+    auto id = free_ids.back();
+    free_ids.pop_back();
+    return id;
+  }
+
+  void buffer_pool::put_back(std::uint16_t id) noexcept {
+    // never grows past the reserved count
+    free_ids.push_back(id);
+  }
+
+  void buffer_pool::release(std::uint16_t id) {
+    put_back(id);
+  }
+
+  covent::detail::buffer_group_impl*
+  evloop::create_buffer_group(unsigned count, std::size_t size) {
+    return new buffer_pool(count, size);
+  }
+
+
+  awaiter_sleep::awaiter_sleep(evloop& l, std::chrono::nanoseconds&& ns)
+    : loop(l), when(timer_clock::now() + ns) {
+    /* nothing to do here */
+  }
+
+  awaiter_sleep::awaiter_sleep(evloop& l, timer_clock::time_point&& tp)
+    : loop(l), when(tp) {
+    /* nothing to do here */
+  }
+
+  awaiter_sleep::~awaiter_sleep() {
+    if (armed())
+      loop.cancel_timer(this);
+  }
+
+  bool awaiter_sleep::await_ready() {
+    return fired;
+  }
+
+  void awaiter_sleep::await_suspend() {
+    if (!started)
+      start();
+  }
+
+  void awaiter_sleep::start() {
+    started = true;
+    loop.arm_timer(this, when);
+  }
+
+  int awaiter_sleep::await_resume() {
+    return res;
+  }
+
+  void awaiter_sleep::cancel() {
+    if (!armed())
+      return;
+    loop.cancel_timer(this);
+    res = -ECANCELED;
+    fired = true;
+    if (parent != nullptr && !parent.done())
+      parent.resume();
+  }
+
+  void awaiter_sleep::set_timeout(std::chrono::nanoseconds ns) {
+    if (auto limit = timer_clock::now() + ns; limit < when) {
+      when = limit;
+      timed_out = true;
+    }
+  }
+
+  void awaiter_sleep::expire() {
+    if (timed_out)
+      res = -ETIME;
+    fired = true;
+    if (parent != nullptr && !parent.done())
+      parent.resume();
+  }
+
+
+  awaiter_timerfd::awaiter_timerfd(evloop& l, int clock,
+                                   std::chrono::nanoseconds since_epoch)
+    : operation(l, ::timerfd_create(clock, TFD_NONBLOCK | TFD_CLOEXEC),
+                EPOLLIN) {
+    if (fd < 0) {
+      error = -errno;
+      return;
+    }
+
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+    itimerspec its = {};
+    its.it_value = { secs.count(), (since_epoch - secs).count() };
+
+    // a deadline at the epoch itself would disarm the timer
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+      its.it_value.tv_nsec = 1;
+
+    if (::timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, nullptr) < 0)
+      error = -errno;
+  }
+
+  awaiter_timerfd::~awaiter_timerfd() {
+    // the registration goes away with the descriptor
+    loop.unwatch(this);
+    if (fd >= 0)
+      ::close(fd);
+  }
+
+  bool awaiter_timerfd::eager() const noexcept {
+    // deadlines are rarely in the past already
+    return error != 0;
+  }
+
+  int awaiter_timerfd::attempt() {
+    if (error != 0)
+      return error;
+
+    // reaching the deadline is success here
+    std::uint64_t expirations;
+    return ::read(fd, &expirations, sizeof(expirations)) < 0 ? -errno : 0;
+  }
+
+  event_awaiter evloop::create_event_awaiter(std::chrono::system_clock::time_point&& tp) {
+    return {
+      *this, std::in_place_type<awaiter_timerfd>, *this,
+      CLOCK_REALTIME, tp.time_since_epoch()
+    };
+  }
+
+  event_awaiter evloop::create_event_awaiter(covent::boot_clock::time_point&& tp) {
+    return {
+      *this, std::in_place_type<awaiter_timerfd>, *this,
+      CLOCK_BOOTTIME, tp.time_since_epoch()
+    };
+  }
+
+
+  stream_poll::stream_poll(evloop& l, op::poll_multishot&& o)
+    : stream_watcher(l, l.resolve(o.fd, o.fixed), o.events, o.buffer) {
+    /* nothing to do here */
+  }
+
+  void stream_poll::ready(std::uint32_t events) {
+    deliver(static_cast<int>(events));
+  }
+
+  covent::event_stream<int>
+  evloop::create_event_stream(op::poll_multishot&& o) {
+    return covent::event_stream<int>(new stream_poll(*this, std::move(o)));
+  }
+
+}
@@ -0,0 +1,493 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_EPOLL_AWAITERS_HH
+#define COVENT_EPOLL_AWAITERS_HH
+
+#include "../impl.hh"
+#include "../timers.hh"
+#include "evloop.hh"
+
+#include <memory>
+#include <vector>
+
+namespace covent::epoll {
+
+  class operation;
+
+  // timeout of an operation, only allocated if one was set
+  class operation_timer final : public covent::detail::timer_node {
+    protected:
+      operation& op;
+
+    public:
+      std::chrono::nanoseconds after = {};
+
+      operation_timer(operation& o) noexcept : op(o) {
+        /* nothing to do here */
+      }
+
+      void expire();
+  };
+
+  // Emulates a completion on top of readiness: the system call runs
+  // right away if it doesn't block, otherwise once epoll reports the
+  // descriptor ready, and again every time it would still block.
+  // Operations without anything to wait for, like those on regular
+  // files epoll doesn't support, run synchronously.
+  class operation : public covent::detail::event_awaiter_impl,
+                    public watcher {
+    friend class evloop;
+    friend class operation_timer;
+
+    protected:
+      // next operation of a chain, started once this one completed
+      operation* chained = nullptr;
+      std::unique_ptr<operation_timer> timer;
+
+      int res = 0;
+      bool started = false;
+      bool completed = false;
+      bool tried = false;
+      bool hard = false;
+
+      // Run the system call and return its result, a negated errno
+      // value or -EAGAIN to wait for readiness. Operations with an
+      // interest of zero never wait. It must not block before tried is
+      // set; after that the descriptor was reported ready or epoll
+      // refused it.
+      virtual int attempt() = 0;
+
+      // whether to attempt before waiting for readiness the first time;
+      // for calls that usually find something to do
+      virtual bool eager() const noexcept {
+        return true;
+      }
+
+      bool try_attempt();
+      void finish(int);
+      void expire();
+
+    public:
+      operation(evloop&, int fd = -1, std::uint32_t interest = 0);
+      ~operation();
+
+      bool await_ready() final;
+      void await_suspend() final;
+      int await_resume() final;
+
+      void start() final;
+      void cancel() final;
+      void set_timeout(std::chrono::nanoseconds) final;
+
+      // make this part of a chain that resumes c, if given, once done
+      void chain(operation*, bool, std::coroutine_handle<>);
+
+      void ready(std::uint32_t) final;
+  };
+
+  // buffer group handing out buffers from a free list in user space
+  class buffer_pool final : public covent::detail::buffer_group_impl {
+    protected:
+      std::byte* memory;
+      std::size_t size;
+      std::vector<std::uint16_t> free_ids;
+
+      void release(std::uint16_t);
+
+    public:
+      buffer_pool(unsigned, std::size_t);
+      ~buffer_pool();
+
+      std::byte* data(std::uint16_t id) noexcept {
+        return memory + id * size;
+      }
+
+      std::size_t buffer_size() const noexcept {
+        return size;
+      }
+
+      // id of a free buffer or -1 if all of them are in use
+      int take() noexcept;
+      void put_back(std::uint16_t id) noexcept;
+  };
+
+  class awaiter_sleep final : public covent::detail::event_awaiter_impl,
+                              public covent::detail::timer_node {
+    protected:
+      evloop& loop;
+      covent::detail::timer_clock::time_point when;
+      int res = 0;
+      bool timed_out = false;
+      bool started = false;
+      bool fired = false;
+
+    public:
+      awaiter_sleep(evloop&, std::chrono::nanoseconds&&);
+      awaiter_sleep(evloop&, covent::detail::timer_clock::time_point&&);
+      ~awaiter_sleep();
+
+      bool await_ready();
+      void await_suspend();
+      int await_resume();
+
+      void start();
+      void cancel();
+      void set_timeout(std::chrono::nanoseconds);
+
+      void expire();
+  };
+
+  // absolute timeout on a kernel clock other than the monotonic one,
+  // waiting for a timerfd of its own
+  class awaiter_timerfd final : public operation {
+    protected:
+      int error = 0;
+
+      int attempt();
+      bool eager() const noexcept;
+
+    public:
+      awaiter_timerfd(evloop&, int, std::chrono::nanoseconds);
+      ~awaiter_timerfd();
+  };
+
+  class awaiter_accept final : public operation {
+    protected:
+      op::accept op;
+
+      int attempt();
+      bool eager() const noexcept;
+
+    public:
+      awaiter_accept(evloop&, op::accept&&);
+  };
+
+  // connects in non-blocking mode and picks up the result once the
+  // socket turns writable
+  class awaiter_connect final : public operation {
+    protected:
+      op::connect op;
+      int saved_flags = -1;
+
+      int attempt();
+      void restore();
+
+    public:
+      awaiter_connect(evloop&, op::connect&&);
+      ~awaiter_connect();
+  };
+
+  class awaiter_recv final : public operation {
+    protected:
+      op::recv op;
+
+      int attempt();
+
+    public:
+      awaiter_recv(evloop&, op::recv&&);
+  };
+
+  class awaiter_send final : public operation {
+    protected:
+      op::send op;
+
+      int attempt();
+
+    public:
+      awaiter_send(evloop&, op::send&&);
+  };
+
+  class awaiter_sendmsg final : public operation {
+    protected:
+      op::sendmsg op;
+
+      int attempt();
+
+    public:
+      awaiter_sendmsg(evloop&, op::sendmsg&&);
+  };
+
+  class awaiter_shutdown final : public operation {
+    protected:
+      op::shutdown op;
+
+      int attempt();
+
+    public:
+      awaiter_shutdown(evloop&, op::shutdown&&);
+  };
+
+  // Reads and writes are attempted without blocking first, which
+  // regular files support for data in the page cache; once they would
+  // block, epoll refuses the file and they run synchronously.
+  class awaiter_read final : public operation {
+    protected:
+      op::read op;
+
+      int attempt();
+
+    public:
+      awaiter_read(evloop&, op::read&&);
+  };
+
+  class awaiter_write final : public operation {
+    protected:
+      op::write op;
+
+      int attempt();
+
+    public:
+      awaiter_write(evloop&, op::write&&);
+  };
+
+  class awaiter_writev final : public operation {
+    protected:
+      op::writev op;
+
+      int attempt();
+
+    public:
+      awaiter_writev(evloop&, op::writev&&);
+  };
+
+  class awaiter_openat final : public operation {
+    protected:
+      op::openat op;
+
+      int attempt();
+
+    public:
+      awaiter_openat(evloop&, op::openat&&);
+  };
+
+  class awaiter_fsync final : public operation {
+    protected:
+      op::fsync op;
+
+      int attempt();
+
+    public:
+      awaiter_fsync(evloop&, op::fsync&&);
+  };
+
+  class awaiter_fallocate final : public operation {
+    protected:
+      op::fallocate op;
+
+      int attempt();
+
+    public:
+      awaiter_fallocate(evloop&, op::fallocate&&);
+  };
+
+  class awaiter_statx final : public operation {
+    protected:
+      op::statx op;
+
+      int attempt();
+
+    public:
+      awaiter_statx(evloop&, op::statx&&);
+  };
+
+  class awaiter_close final : public operation {
+    protected:
+      op::close op;
+
+      int attempt();
+
+    public:
+      awaiter_close(evloop&, op::close&&);
+  };
+
+  // Feeds an event stream from readiness of a descriptor, which stays
+  // watched while the stream is active. Results are delivered like
+  // push() does, but the consumer is resumed at the end of the round.
+  template<typename T>
+  class stream_watcher : public covent::detail::event_stream_impl<T>,
+                         public watcher,
+                         public covent::detail::timer_node {
+    protected:
+      T failure = T();
+
+      void deliver(T res) {
+        this->results.push(std::move(res));
+
+        if (!this->paused && this->results.size() >= this->capacity) {
+          this->paused = true;
+          stop();
+        }
+
+        if (this->waiter != nullptr)
+          loop.defer(std::exchange(this->waiter, nullptr));
+      }
+
+    public:
+      stream_watcher(evloop& l, int f, std::uint32_t events,
+                     std::size_t buffer)
+        : covent::detail::event_stream_impl<T>(buffer), watcher(l) {
+        fd = f;
+        interest = events;
+      }
+
+      ~stream_watcher() {
+        if (armed())
+          loop.cancel_timer(this);
+      }
+
+      void start() {
+        // the consumer only waits once this returned, so failing to
+        // watch is reported from a timer
+        if (auto r = loop.watch(this); r < 0) {
+          failure = T(r);
+          loop.arm_timer(this, covent::detail::timer_clock::now());
+        }
+      }
+
+      void stop() {
+        loop.unwatch(this);
+      }
+
+      bool active() const {
+        return watching || armed();
+      }
+
+      void expire() {
+        deliver(std::move(failure));
+      }
+  };
+
+  class stream_accept final : public stream_watcher<int> {
+    protected:
+      op::multishot_accept op;
+
+    public:
+      stream_accept(evloop&, op::multishot_accept&&);
+      ~stream_accept();
+
+      void ready(std::uint32_t);
+  };
+
+  class stream_recv final : public stream_watcher<covent::buffer_view> {
+    protected:
+      op::recv_multishot op;
+
+    public:
+      stream_recv(evloop&, op::recv_multishot&&);
+
+      void ready(std::uint32_t);
+  };
+
+  // level triggered, so readiness is reported again until the
+  // condition is gone
+  class stream_poll final : public stream_watcher<int> {
+    public:
+      stream_poll(evloop&, op::poll_multishot&&);
+
+      void ready(std::uint32_t);
+  };
+
+}
+
+namespace covent::detail {
+
+  // awaiters created right in the awaiting coroutine, for builds using
+  // the epoll loop exclusively
+  template<>
+  struct awaiter_factory<epoll::evloop> {
+      template<typename ImplType, typename ...Args>
+      static direct_awaiter<ImplType> make(evloop_base& loop, Args&& ...args) {
+        return {
+          std::in_place, static_cast<epoll::evloop&>(loop),
+          std::forward<Args>(args)...
+        };
+      }
+
+      static auto create(evloop_base& l, std::chrono::nanoseconds&& ns) {
+        return make<epoll::awaiter_sleep>(l, std::move(ns));
+      }
+
+      static auto create(evloop_base& l, std::chrono::steady_clock::time_point&& tp) {
+        return make<epoll::awaiter_sleep>(l, std::move(tp));
+      }
+
+      static auto create(evloop_base& l, std::chrono::system_clock::time_point&& tp) {
+        return make<epoll::awaiter_timerfd>(l, CLOCK_REALTIME, tp.time_since_epoch());
+      }
+
+      static auto create(evloop_base& l, boot_clock::time_point&& tp) {
+        return make<epoll::awaiter_timerfd>(l, CLOCK_BOOTTIME, tp.time_since_epoch());
+      }
+
+      static auto create(evloop_base& l, op::accept&& o) {
+        return make<epoll::awaiter_accept>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::connect&& o) {
+        return make<epoll::awaiter_connect>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::recv&& o) {
+        return make<epoll::awaiter_recv>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::send&& o) {
+        return make<epoll::awaiter_send>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::sendmsg&& o) {
+        return make<epoll::awaiter_sendmsg>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::shutdown&& o) {
+        return make<epoll::awaiter_shutdown>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::read&& o) {
+        return make<epoll::awaiter_read>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::write&& o) {
+        return make<epoll::awaiter_write>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::writev&& o) {
+        return make<epoll::awaiter_writev>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::openat&& o) {
+        return make<epoll::awaiter_openat>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::fsync&& o) {
+        return make<epoll::awaiter_fsync>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::fallocate&& o) {
+        return make<epoll::awaiter_fallocate>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::statx&& o) {
+        return make<epoll::awaiter_statx>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::close&& o) {
+        return make<epoll::awaiter_close>(l, std::move(o));
+      }
+  };
+
+}
+
+#endif
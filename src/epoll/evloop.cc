@@ -0,0 +1,397 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <covent/event_loop.hh>
+
+#include "awaiters.hh"
+#include "evloop.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace covent {
+
+  // create the event loop implementation
+  template<> template<>
+  detail::evloop_base*
+  event_loop::create<evloop_epoll>(const event_loop_config&& conf) {
+    return new evloop_epoll(std::move(conf));
+  }
+
+}
+
+namespace covent::epoll {
+
+  using covent::detail::timer_clock;
+  using covent::detail::event_awaiter;
+  using covent::detail::posted_work;
+
+  evloop::evloop(const event_loop_config&& conf)
+    : evloop_base(conf),
+      events(static_cast<std::size_t>(
+        std::max(conf.get<int>("max_events", 256), 1))),
+      timers(std::chrono::nanoseconds(conf.get<int>("timer_slack", 0))) {
+    auto fail = [this](const char* what) {
+      auto err = errno;
+      for (auto fd : { epfd, timer_fd, event_fd }) {
+        if (fd >= 0)
+          ::close(fd);
+      }
+      throw std::system_error(err, std::system_category(), what);
+    };
+
+    if (epfd = ::epoll_create1(EPOLL_CLOEXEC); epfd < 0)
+      fail("epoll_create1()");
+
+    // the earliest user space timer bounds the wait
+    if (timer_fd = ::timerfd_create(CLOCK_MONOTONIC,
+                                    TFD_NONBLOCK | TFD_CLOEXEC); timer_fd < 0)
+      fail("timerfd_create()");
+
+    // wakes the loop up for posted work
+    if (event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC); event_fd < 0)
+      fail("eventfd()");
+
+    for (auto fd : { timer_fd, event_fd }) {
+      epoll_event ev = {};
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+      if (::epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        fail("epoll_ctl()");
+    }
+
+    // Emulated fixed file table: registered_files slots managed by the
+    // registry, then files slots for direct descriptors.
+    registered_files = conf.get<int>("registered_files", 0);
+    auto direct = conf.get<int>("files", 0);
+    files.assign(registered_files + direct, -1);
+    file_slots.reset(registered_files);
+    direct_slots.reset(direct);
+
+    buffer_slots.reset(conf.get<int>("registered_buffers", 0));
+  }
+
+  evloop::~evloop() {
+    retire();
+
+    // descriptors the table still owns
+    for (auto fd : files) {
+      if (fd >= 0)
+        ::close(fd);
+    }
+    ::close(event_fd);
+    ::close(timer_fd);
+    ::close(epfd);
+  }
+
+  static_assert(sizeof(awaiter_sleep) <= event_awaiter::storage_size,
+                "awaiter_sleep doesn't fit the inline storage");
+  static_assert(sizeof(awaiter_timerfd) <= event_awaiter::storage_size,
+                "awaiter_timerfd doesn't fit the inline storage");
+
+  event_awaiter evloop::create_event_awaiter(std::chrono::nanoseconds&& ns) {
+    return { *this, std::in_place_type<awaiter_sleep>, *this, std::move(ns) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(std::chrono::steady_clock::time_point&& tp) {
+    return { *this, std::in_place_type<awaiter_sleep>, *this, std::move(tp) };
+  }
+
+  void evloop::run_once() {
+    // coroutines woken up by the previous round go first
+    auto resumed = run_ready();
+
+    // Don't wait while coroutines ran or are ready to run or a timer
+    // expired already; otherwise the earliest timer is set on the
+    // timerfd, which wakes up the wait.
+    int timeout = -1;
+
+    if (resumed > 0 || has_ready() || !deferred.empty())
+      timeout = 0;
+    else if (!timers.empty()) {
+      if (auto next = timers.next(); next <= timer_clock::now())
+        timeout = 0;
+      else
+        set_timer(next);
+    }
+
+    auto count = ::epoll_wait(epfd, events.data(),
+                              static_cast<int>(events.size()), timeout);
+    if (count < 0) {
+      if (errno != EINTR)
+        throw std::system_error(errno, std::system_category(),
+                                "epoll_wait()");
+      count = 0;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      auto fd = events[i].data.fd;
+      if (fd == event_fd)
+        run_posted();
+      else if (fd == timer_fd) {
+        std::uint64_t expirations;
+        if (::read(timer_fd, &expirations, sizeof(expirations)) > 0)
+          timer_set = timer_clock::time_point::max();
+      }
+      else
+        dispatch(fd, events[i].events);
+    }
+
+    if (!timers.empty())
+      timers.expire(timer_clock::now());
+
+    run_deferred();
+  }
+
+  void evloop::set_timer(timer_clock::time_point when) {
+    if (when == timer_set)
+      return;
+
+    auto ns = when.time_since_epoch();
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(ns);
+    itimerspec its = {};
+    its.it_value = { secs.count(), (ns - secs).count() };
+    if (::timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, nullptr) < 0)
+      throw std::system_error(errno, std::system_category(),
+                              "timerfd_settime()");
+    timer_set = when;
+  }
+
+  void evloop::run_deferred() {
+    std::swap(deferred, resuming);
+    for (auto c : resuming) {
+      if (!c.done())
+        c.resume();
+    }
+    resuming.clear();
+  }
+
+  void evloop::dispatch(int fd, std::uint32_t ev) {
+    if (static_cast<std::size_t>(fd) >= fds.size())
+      return;
+
+    // errors and hang ups concern everybody; watchers only ever remove
+    // themselves, so the next one stays valid
+    for (auto w = fds[fd].head; w != nullptr;) {
+      auto next = w->next;
+      if (ev & (w->interest | EPOLLERR | EPOLLHUP))
+        w->ready(ev);
+      w = next;
+    }
+
+    // stop reporting events nobody waits for anymore
+    update(fd, fds[fd], false);
+  }
+
+  int evloop::update(int fd, fd_entry& e, bool force) {
+    std::uint32_t want = 0;
+    for (auto w = e.head; w != nullptr; w = w->next)
+      want |= w->interest;
+
+    if (want == 0) {
+      if (e.added)
+        ::epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+      e.added = false;
+      e.registered = 0;
+      return 0;
+    }
+
+    if (!force && e.added && want == e.registered)
+      return 0;
+
+    epoll_event ev = {};
+    ev.events = want;
+    ev.data.fd = fd;
+
+    // The registration goes away with the last descriptor of a file,
+    // possibly behind our back, and the number gets reused; an idle
+    // descriptor is registered anew to be sure.
+    auto op = e.added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (::epoll_ctl(epfd, op, fd, &ev) < 0) {
+      if (errno != ENOENT && errno != EEXIST)
+        return -errno;
+      op = errno == ENOENT ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+      if (::epoll_ctl(epfd, op, fd, &ev) < 0)
+        return -errno;
+    }
+
+    e.added = true;
+    e.registered = want;
+    return 0;
+  }
+
+  int evloop::watch(watcher* w) {
+    if (w->watching)
+      return 0;
+    if (w->fd < 0)
+      return -EBADF;
+
+    if (static_cast<std::size_t>(w->fd) >= fds.size())
+      fds.resize(w->fd + 1);
+    auto& e = fds[w->fd];
+    auto idle = e.head == nullptr;
+
+    w->prev = nullptr;
+    w->next = e.head;
+    if (e.head != nullptr)
+      e.head->prev = w;
+    e.head = w;
+    w->watching = true;
+
+    if (auto r = update(w->fd, e, idle); r < 0) {
+      unwatch(w);
+      return r;
+    }
+    return 0;
+  }
+
+  void evloop::unwatch(watcher* w) noexcept {
+    // the registration is updated lazily with the next events
+    if (!w->watching)
+      return;
+
+    auto& e = fds[w->fd];
+    if (w->prev != nullptr)
+      w->prev->next = w->next;
+    else
+      e.head = w->next;
+    if (w->next != nullptr)
+      w->next->prev = w->prev;
+    w->watching = false;
+  }
+
+  void evloop::submit_chain(event_awaiter* aws, std::size_t count, bool hard,
+                            std::coroutine_handle<> c) {
+    auto op_at = [aws](std::size_t i) {
+      auto o = dynamic_cast<operation*>(impl_of(aws[i]));
+      if (o == nullptr)
+        throw std::invalid_argument(
+          "only descriptor based operations can be chained"
+        );
+      return o;
+    };
+
+    // check all of them before marking any as part of a chain
+    for (std::size_t i = 0; i < count; ++i)
+      op_at(i);
+
+    // each operation starts the next one once it completed, only the
+    // last one resumes
+    for (std::size_t i = 0; i < count; ++i) {
+      if (i + 1 < count)
+        op_at(i)->chain(op_at(i + 1), hard, nullptr);
+      else
+        op_at(i)->chain(nullptr, false, c);
+    }
+
+    if (count > 0)
+      op_at(0)->start();
+  }
+
+  void evloop::post(posted_work* w) {
+    w->target = this;
+
+    auto head = posted.load(std::memory_order_relaxed);
+    do {
+      w->posted_next = head;
+    } while (!posted.compare_exchange_weak(head, w,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed));
+
+    // the first one in wakes up the loop, the others find it woken up
+    if (head == nullptr) {
+      std::uint64_t one = 1;
+      // only fails if the counter is about to overflow, which means the
+      // loop is going to wake up anyway
+      [[maybe_unused]] auto ret = ::write(event_fd, &one, sizeof(one));
+    }
+  }
+
+  void evloop::run_posted() {
+    std::uint64_t count;
+    [[maybe_unused]] auto ret = ::read(event_fd, &count, sizeof(count));
+
+    // the stack has the newest first; reverse it to run in order
+    posted_work* work = nullptr;
+    for (auto w = posted.exchange(nullptr, std::memory_order_acquire);
+         w != nullptr;)
+      work = std::exchange(w, std::exchange(w->posted_next, work));
+
+    // work may delete itself when run
+    while (work != nullptr)
+      std::exchange(work, work->posted_next)->run();
+  }
+
+  int evloop::register_file(int fd) {
+    auto index = file_slots.allocate();
+    if (index < 0)
+      throw std::system_error(ENFILE, std::system_category(),
+                              "no free fixed file slot");
+
+    // the table holds on to the file like the kernel does, so the
+    // descriptor may be closed afterwards
+    if (files[index] = ::fcntl(fd, F_DUPFD_CLOEXEC, 0); files[index] < 0) {
+      auto err = errno;
+      file_slots.release(index);
+      throw std::system_error(err, std::system_category(), "fcntl()");
+    }
+    return index;
+  }
+
+  void evloop::unregister_file(int index) {
+    ::close(std::exchange(files[index], -1));
+    file_slots.release(index);
+  }
+
+  int evloop::install_direct(int fd) {
+    auto slot = direct_slots.allocate();
+    if (slot < 0) {
+      ::close(fd);
+      return -ENFILE;
+    }
+    files[registered_files + slot] = fd;
+    return registered_files + slot;
+  }
+
+  int evloop::register_buffers(const iovec*, unsigned count) {
+    auto first = buffer_slots.allocate(count);
+    if (first < 0)
+      throw std::system_error(ENOBUFS, std::system_category(),
+                              "no free fixed buffer slots");
+    return first;
+  }
+
+  void evloop::unregister_buffers(int first, unsigned count) {
+    buffer_slots.release(first, count);
+  }
+
+  void evloop::close_fixed(int index) {
+    if (index < registered_files) {
+      unregister_file(index);
+      return;
+    }
+
+    ::close(std::exchange(files[index], -1));
+    direct_slots.release(index - registered_files);
+  }
+
+}
@@ -0,0 +1,188 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_EPOLL_EVLOOP_HH
+#define COVENT_EPOLL_EVLOOP_HH
+
+#include <covent/base.hh>
+
+#include "../registry.hh"
+#include "../timers.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <sys/epoll.h>
+#include <vector>
+
+namespace covent::epoll {
+
+  class evloop;
+
+  // Waits for readiness of a file descriptor. All watchers of a
+  // descriptor share its registration with epoll, which asks for the
+  // union of their interests.
+  class watcher {
+    friend class evloop;
+
+    protected:
+      evloop& loop;
+      int fd = -1;
+      std::uint32_t interest = 0;
+
+      // links into the watchers of the descriptor
+      watcher* prev;
+      watcher* next;
+      bool watching = false;
+
+    public:
+      watcher(evloop& l) noexcept : loop(l) {
+        /* nothing to do here */
+      }
+
+      virtual ~watcher();
+
+      // not copyable
+      watcher(const watcher&) = delete;
+      watcher& operator=(const watcher&) = delete;
+
+      // the descriptor reported some of the events; must not resume
+      // coroutines right away
+      virtual void ready(std::uint32_t) = 0;
+  };
+
+  class evloop final : public covent::detail::evloop_base {
+    private:
+      struct fd_entry {
+          watcher* head = nullptr;
+          // events epoll is asked to report, if registered
+          std::uint32_t registered = 0;
+          bool added = false;
+      };
+
+      int epfd = -1;
+      int timer_fd = -1;
+      int event_fd = -1;
+      std::vector<epoll_event> events;
+
+      // user space timers; the earliest one is set on a timerfd
+      covent::detail::timer_heap timers;
+      covent::detail::timer_clock::time_point timer_set =
+        covent::detail::timer_clock::time_point::max();
+
+      // indexed by file descriptor
+      std::vector<fd_entry> fds;
+
+      // Coroutines of completed operations, resumed once all events of
+      // a round were handled: resuming them while handling events could
+      // destroy watchers still to be visited. Swapped with resuming to
+      // leave the ones deferred meanwhile for the next round.
+      std::vector<std::coroutine_handle<>> deferred;
+      std::vector<std::coroutine_handle<>> resuming;
+
+      // work posted from any thread, newest first
+      std::atomic<covent::detail::posted_work*> posted = nullptr;
+
+      // Emulated fixed file table: descriptors by index. The registry
+      // hands out slots up to registered_files, direct accepts the ones
+      // after them.
+      std::vector<int> files;
+      covent::detail::slot_allocator file_slots;
+      covent::detail::slot_allocator direct_slots;
+      int registered_files = 0;
+
+      // fixed buffers are plain memory here; only their slots are kept
+      covent::detail::slot_allocator buffer_slots;
+
+      int update(int, fd_entry&, bool);
+      void dispatch(int, std::uint32_t);
+      void run_posted();
+      void run_deferred();
+      void set_timer(covent::detail::timer_clock::time_point);
+
+    public:
+      evloop(const covent::event_loop_config&&);
+      ~evloop();
+
+      void run_once();
+
+      // start watching; -EPERM for descriptors epoll doesn't support,
+      // e.g. regular files
+      int watch(watcher*);
+      void unwatch(watcher*) noexcept;
+
+      // resume a coroutine at the end of the current round
+      void defer(std::coroutine_handle<> c) {
+        deferred.push_back(c);
+      }
+
+      void arm_timer(covent::detail::timer_node* node,
+                     covent::detail::timer_clock::time_point when) {
+        timers.arm(node, when);
+      }
+
+      void cancel_timer(covent::detail::timer_node* node) noexcept {
+        timers.cancel(node);
+      }
+
+      // descriptor behind an index into the fixed file table if fixed
+      int resolve(int fd, bool fixed) const noexcept {
+        return fixed ? (fd >= 0 && static_cast<std::size_t>(fd) < files.size()
+                          ? files[fd] : -1)
+                     : fd;
+      }
+
+      // put a descriptor into a free slot for direct descriptors,
+      // -ENFILE if there is none
+      int install_direct(int);
+
+      covent::detail::event_awaiter create_event_awaiter(std::chrono::nanoseconds&&);
+      covent::detail::event_awaiter create_event_awaiter(std::chrono::steady_clock::time_point&&);
+      covent::detail::event_awaiter create_event_awaiter(std::chrono::system_clock::time_point&&);
+      covent::detail::event_awaiter create_event_awaiter(covent::boot_clock::time_point&&);
+      covent::detail::event_awaiter create_event_awaiter(op::accept&&);
+      covent::detail::event_awaiter create_event_awaiter(op::connect&&);
+      covent::detail::event_awaiter create_event_awaiter(op::recv&&);
+      covent::detail::event_awaiter create_event_awaiter(op::send&&);
+      covent::detail::event_awaiter create_event_awaiter(op::sendmsg&&);
+      covent::detail::event_awaiter create_event_awaiter(op::writev&&);
+      covent::detail::event_awaiter create_event_awaiter(op::read&&);
+      covent::detail::event_awaiter create_event_awaiter(op::write&&);
+      covent::detail::event_awaiter create_event_awaiter(op::openat&&);
+      covent::detail::event_awaiter create_event_awaiter(op::fsync&&);
+      covent::detail::event_awaiter create_event_awaiter(op::fallocate&&);
+      covent::detail::event_awaiter create_event_awaiter(op::statx&&);
+      covent::detail::event_awaiter create_event_awaiter(op::close&&);
+      covent::detail::event_awaiter create_event_awaiter(op::shutdown&&);
+
+      covent::event_stream<int> create_event_stream(op::multishot_accept&&);
+      covent::event_stream<covent::buffer_view> create_event_stream(op::recv_multishot&&);
+      covent::event_stream<int> create_event_stream(op::poll_multishot&&);
+
+      void submit_chain(covent::detail::event_awaiter*, std::size_t, bool,
+                        std::coroutine_handle<>);
+
+      void post(covent::detail::posted_work*);
+
+      covent::detail::buffer_group_impl* create_buffer_group(unsigned, std::size_t);
+
+      int register_file(int);
+      void unregister_file(int);
+      int register_buffers(const iovec*, unsigned);
+      void unregister_buffers(int, unsigned);
+      void close_fixed(int);
+  };
+
+}
+
+#endif
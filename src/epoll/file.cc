@@ -0,0 +1,176 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "awaiters.hh"
+#include "evloop.hh"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace covent::epoll {
+
+  using covent::detail::event_awaiter;
+
+  // an offset of -1 uses and advances the file position just like
+  // io_uring does
+  static off_t to_offset(std::uint64_t offset) {
+    return static_cast<off_t>(offset);
+  }
+
+  awaiter_read::awaiter_read(evloop& l, op::read&& o)
+    : operation(l, l.resolve(o.fd, o.fixed), EPOLLIN), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_read::attempt() {
+    iovec iov = { op.buf, op.len };
+    auto r = ::preadv2(fd, &iov, 1, to_offset(op.offset),
+                       tried ? 0 : RWF_NOWAIT);
+    // can't tell without waiting whether it would block
+    if (r < 0 && errno == EOPNOTSUPP && !tried)
+      return -EAGAIN;
+    return r < 0 ? -errno : static_cast<int>(r);
+  }
+
+
+  awaiter_write::awaiter_write(evloop& l, op::write&& o)
+    : operation(l, l.resolve(o.fd, o.fixed), EPOLLOUT), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_write::attempt() {
+    iovec iov = { const_cast<void*>(op.buf), op.len };
+    auto r = ::pwritev2(fd, &iov, 1, to_offset(op.offset),
+                        tried ? 0 : RWF_NOWAIT);
+    if (r < 0 && errno == EOPNOTSUPP && !tried)
+      return -EAGAIN;
+    return r < 0 ? -errno : static_cast<int>(r);
+  }
+
+
+  awaiter_writev::awaiter_writev(evloop& l, op::writev&& o)
+    : operation(l, l.resolve(o.fd, o.fixed), EPOLLOUT), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_writev::attempt() {
+    auto r = ::pwritev2(fd, op.iov, static_cast<int>(op.count),
+                        to_offset(op.offset), tried ? 0 : RWF_NOWAIT);
+    if (r < 0 && errno == EOPNOTSUPP && !tried)
+      return -EAGAIN;
+    return r < 0 ? -errno : static_cast<int>(r);
+  }
+
+
+  awaiter_openat::awaiter_openat(evloop& l, op::openat&& o)
+    : operation(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_openat::attempt() {
+    auto r = ::openat(op.dirfd, op.path, op.flags, op.mode);
+    return r < 0 ? -errno : r;
+  }
+
+
+  awaiter_fsync::awaiter_fsync(evloop& l, op::fsync&& o)
+    : operation(l, l.resolve(o.fd, o.fixed)), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_fsync::attempt() {
+    auto r = op.datasync ? ::fdatasync(fd) : ::fsync(fd);
+    return r < 0 ? -errno : 0;
+  }
+
+
+  awaiter_fallocate::awaiter_fallocate(evloop& l, op::fallocate&& o)
+    : operation(l, l.resolve(o.fd, o.fixed)), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_fallocate::attempt() {
+    return ::fallocate(fd, op.mode, to_offset(op.offset),
+                       to_offset(op.len)) < 0 ? -errno : 0;
+  }
+
+
+  awaiter_statx::awaiter_statx(evloop& l, op::statx&& o)
+    : operation(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_statx::attempt() {
+    return ::statx(op.dirfd, op.path, op.flags, op.mask, op.buf) < 0
+      ? -errno : 0;
+  }
+
+
+  awaiter_close::awaiter_close(evloop& l, op::close&& o)
+    : operation(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_close::attempt() {
+    if (op.fixed) {
+      if (loop.resolve(op.fd, true) < 0)
+        return -EBADF;
+      loop.close_fixed(op.fd);
+      return 0;
+    }
+    return ::close(op.fd) < 0 ? -errno : 0;
+  }
+
+
+  static_assert(sizeof(awaiter_read) <= event_awaiter::storage_size,
+                "awaiter_read doesn't fit the inline storage");
+  static_assert(sizeof(awaiter_write) <= event_awaiter::storage_size,
+                "awaiter_write doesn't fit the inline storage");
+
+  event_awaiter evloop::create_event_awaiter(op::read&& o) {
+    return { *this, std::in_place_type<awaiter_read>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::write&& o) {
+    return { *this, std::in_place_type<awaiter_write>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::writev&& o) {
+    return { *this, std::in_place_type<awaiter_writev>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::openat&& o) {
+    return { *this, std::in_place_type<awaiter_openat>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::fsync&& o) {
+    return { *this, std::in_place_type<awaiter_fsync>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::fallocate&& o) {
+    return { *this, std::in_place_type<awaiter_fallocate>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::statx&& o) {
+    return { *this, std::in_place_type<awaiter_statx>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::close&& o) {
+    return { *this, std::in_place_type<awaiter_close>, *this, std::move(o) };
+  }
+
+}
@@ -0,0 +1,247 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "awaiters.hh"
+#include "evloop.hh"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace covent::epoll {
+
+  using covent::buffer_view;
+  using covent::event_stream;
+  using covent::detail::event_awaiter;
+
+  awaiter_accept::awaiter_accept(evloop& l, op::accept&& o)
+    : operation(l, l.resolve(o.fd, o.fixed), EPOLLIN), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  bool awaiter_accept::eager() const noexcept {
+    // the listening socket may well be blocking
+    return false;
+  }
+
+  int awaiter_accept::attempt() {
+    auto r = ::accept4(fd, nullptr, nullptr, op.flags);
+    return r < 0 ? -errno : r;
+  }
+
+
+  awaiter_connect::awaiter_connect(evloop& l, op::connect&& o)
+    : operation(l, l.resolve(o.fd, o.fixed), EPOLLOUT), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  awaiter_connect::~awaiter_connect() {
+    restore();
+  }
+
+  void awaiter_connect::restore() {
+    if (saved_flags >= 0 && !(saved_flags & O_NONBLOCK))
+      ::fcntl(fd, F_SETFL, saved_flags);
+    saved_flags = -1;
+  }
+
+  int awaiter_connect::attempt() {
+    // the socket turned writable: the outcome is waiting in SO_ERROR
+    if (saved_flags >= 0) {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      auto r = ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0
+        ? -errno : -err;
+      restore();
+      return r;
+    }
+
+    if (saved_flags = ::fcntl(fd, F_GETFL); saved_flags < 0)
+      return -errno;
+    if (!(saved_flags & O_NONBLOCK) &&
+        ::fcntl(fd, F_SETFL, saved_flags | O_NONBLOCK) < 0) {
+      saved_flags = -1;
+      return -errno;
+    }
+
+    auto r = ::connect(fd, &op.addr.sa, op.addr.len) < 0 ? -errno : 0;
+    if (r == -EINPROGRESS)
+      return -EAGAIN;
+    restore();
+    return r;
+  }
+
+
+  awaiter_recv::awaiter_recv(evloop& l, op::recv&& o)
+    : operation(l, l.resolve(o.fd, o.fixed), EPOLLIN), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_recv::attempt() {
+    auto r = ::recv(fd, op.buf, op.len, op.flags | MSG_DONTWAIT);
+    return r < 0 ? -errno : static_cast<int>(r);
+  }
+
+
+  awaiter_send::awaiter_send(evloop& l, op::send&& o)
+    : operation(l, l.resolve(o.fd, o.fixed), EPOLLOUT), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_send::attempt() {
+    // fixed buffers are plain memory here, so sends always copy
+    auto r = ::send(fd, op.buf, op.len, op.flags | MSG_DONTWAIT);
+    return r < 0 ? -errno : static_cast<int>(r);
+  }
+
+
+  awaiter_sendmsg::awaiter_sendmsg(evloop& l, op::sendmsg&& o)
+    : operation(l, l.resolve(o.fd, o.fixed), EPOLLOUT), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_sendmsg::attempt() {
+    // zero copy needs the error queue to learn when the pages are free;
+    // copying has the same semantics for the caller
+    auto r = ::sendmsg(fd, op.msg, op.flags | MSG_DONTWAIT);
+    return r < 0 ? -errno : static_cast<int>(r);
+  }
+
+
+  awaiter_shutdown::awaiter_shutdown(evloop& l, op::shutdown&& o)
+    : operation(l, l.resolve(o.fd, o.fixed)), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  int awaiter_shutdown::attempt() {
+    return ::shutdown(fd, op.how) < 0 ? -errno : 0;
+  }
+
+
+  stream_accept::stream_accept(evloop& l, op::multishot_accept&& o)
+    : stream_watcher(l, l.resolve(o.fd, o.fixed), EPOLLIN, o.buffer),
+      op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  stream_accept::~stream_accept() {
+    // close connections nobody picked up
+    while (!results.empty()) {
+      if (auto conn = results.pop(); conn >= 0) {
+        if (op.direct)
+          loop.close_fixed(conn);
+        else
+          ::close(conn);
+      }
+    }
+  }
+
+  void stream_accept::ready(std::uint32_t) {
+    auto r = ::accept4(fd, nullptr, nullptr, op.flags);
+    if (r < 0) {
+      // somebody else was quicker
+      if (errno == EAGAIN)
+        return;
+      r = -errno;
+    }
+    else if (op.direct)
+      r = loop.install_direct(r);
+
+    // errors are handed to the consumer and the next wait starts over
+    if (r < 0)
+      stop();
+    deliver(r);
+  }
+
+
+  stream_recv::stream_recv(evloop& l, op::recv_multishot&& o)
+    : stream_watcher(l, l.resolve(o.fd, o.fixed), EPOLLIN, o.buffer),
+      op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void stream_recv::ready(std::uint32_t) {
+    auto group = static_cast<buffer_pool*>(op.group);
+    auto id = group->take();
+
+    if (id < 0) {
+      op.group->exhausted();
+      stop();
+      // with data still buffered the consumer is going to return
+      // buffers before waiting again, which starts over; otherwise it
+      // holds on to all of them and has to learn about it
+      if (results.empty())
+        deliver(buffer_view(-ENOBUFS));
+      return;
+    }
+
+    auto buf = group->data(static_cast<std::uint16_t>(id));
+    auto r = ::recv(fd, buf, group->buffer_size(), MSG_DONTWAIT);
+    if (r > 0) {
+      deliver(buffer_view(op.group, static_cast<std::uint16_t>(id),
+                          static_cast<int>(r)));
+      return;
+    }
+
+    group->put_back(static_cast<std::uint16_t>(id));
+    if (r < 0 && errno == EAGAIN)
+      return;
+
+    // end of stream or an error ends it
+    stop();
+    deliver(buffer_view(r < 0 ? -errno : 0));
+  }
+
+
+  static_assert(sizeof(awaiter_recv) <= event_awaiter::storage_size,
+                "awaiter_recv doesn't fit the inline storage");
+  static_assert(sizeof(awaiter_send) <= event_awaiter::storage_size,
+                "awaiter_send doesn't fit the inline storage");
+  static_assert(sizeof(awaiter_sendmsg) <= event_awaiter::storage_size,
+                "awaiter_sendmsg doesn't fit the inline storage");
+
+  event_awaiter evloop::create_event_awaiter(op::accept&& o) {
+    return { *this, std::in_place_type<awaiter_accept>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::connect&& o) {
+    return { *this, std::in_place_type<awaiter_connect>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::recv&& o) {
+    return { *this, std::in_place_type<awaiter_recv>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::send&& o) {
+    return { *this, std::in_place_type<awaiter_send>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::sendmsg&& o) {
+    return { *this, std::in_place_type<awaiter_sendmsg>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::shutdown&& o) {
+    return { *this, std::in_place_type<awaiter_shutdown>, *this, std::move(o) };
+  }
+
+  event_stream<int> evloop::create_event_stream(op::multishot_accept&& o) {
+    return event_stream<int>(new stream_accept(*this, std::move(o)));
+  }
+
+  event_stream<buffer_view> evloop::create_event_stream(op::recv_multishot&& o) {
+    return event_stream<buffer_view>(new stream_recv(*this, std::move(o)));
+  }
+
+}
@@ -47,3 +47,24 @@ namespace covent::detail {
   }
 
 }
+
+namespace covent {
+
+  template<typename Loop>
+  basic_event_loop<Loop>::basic_event_loop(const char* name,
+                                           const event_loop_config&& conf)
+    : impl(name == nullptr || *name == '\0'
+             ? create_as<DefaultEventLoopType>(std::move(conf))
+             : with_evloop_type(name, [&]<typename ImplType>(std::in_place_type_t<ImplType>) -> Loop* {
+                 if constexpr (supports<ImplType>)
+                   return create_as<ImplType>(std::move(conf));
+                 else
+                   throw std::invalid_argument(
+                     "library built for another event loop implementation");
+               })) {
+    /* nothing to do here */
+  }
+
+  template class basic_event_loop<detail::loop_type>;
+
+}
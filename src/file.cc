@@ -0,0 +1,150 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <covent/file.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <sys/stat.h>
+#include <system_error>
+
+namespace covent {
+
+  aligned_buffer::aligned_buffer(std::size_t size, std::size_t alignment)
+    : len(size) {
+    // aligned_alloc wants the size to be a multiple of the alignment
+    buf = static_cast<std::byte*>(
+      std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+    );
+    if (buf == nullptr)
+      throw std::bad_alloc();
+  }
+
+  aligned_buffer& aligned_buffer::operator=(aligned_buffer&& other) noexcept {
+    if (&other != this) {
+      std::free(buf);
+      buf = std::exchange(other.buf, nullptr);
+      len = std::exchange(other.len, 0);
+    }
+    return *this;
+  }
+
+  aligned_buffer::~aligned_buffer() {
+    std::free(buf);
+  }
+
+
+  task<file> open_file(std::string path, int flags, mode_t mode) {
+    auto fd = co_await op::openat { AT_FDCWD, path.c_str(), flags, mode };
+    if (fd < 0)
+      throw std::system_error(-fd, std::system_category(), "openat()");
+    co_return file(fd);
+  }
+
+
+  file_reader::file_reader(const file& f, std::size_t bs, unsigned d,
+                           std::uint64_t offset, std::uint64_t length)
+    : fd(f.native_handle()), fixed(f.is_fixed()),
+      block_size(bs), depth(d > 0 ? d : 1),
+      next_offset(offset), blocks(new block[depth]) {
+    auto max = std::numeric_limits<std::uint64_t>::max();
+    end = length > max - offset ? max : offset + length;
+
+    // stop at the current size instead of finding the end of the file
+    // by reading past it; not possible for fixed files
+    if (struct stat st; !fixed && ::fstat(fd, &st) == 0)
+      end = std::min<std::uint64_t>(end, st.st_size);
+
+    for (unsigned i = 0; i < depth; ++i) {
+      blocks[i].buf = aligned_buffer(block_size);
+      issue(blocks[i]);
+    }
+  }
+
+  file_reader::~file_reader() {
+    // The kernel may still write into the buffers of reads that haven't
+    // completed. Leak them rather than have it scribble over memory
+    // that's in use again.
+    for (unsigned i = 0; i < depth; ++i) {
+      if (auto& b = blocks[i]; b.read && !b.read->aw.await_ready())
+        b.buf.release();
+    }
+  }
+
+  void file_reader::issue(block& b) {
+    if (next_offset >= end) {
+      b.read.reset();
+      return;
+    }
+
+    // always reading full blocks keeps O_DIRECT reads aligned; the
+    // kernel stops at the end of the file anyway
+    b.read.emplace(
+      [&] {
+        return detail::get_active_loop().create_event_awaiter(
+          op::read { fd, b.buf.data(), block_size, next_offset, fixed }
+        );
+      },
+      next_offset
+    );
+    b.read->aw.start();
+    next_offset += block_size;
+  }
+
+  file_reader::awaiter file_reader::next() {
+    // the previous block was handed out and is free for reading again
+    if (std::exchange(consumed, false))
+      issue(blocks[(head + depth - 1) % depth]);
+    return { *this };
+  }
+
+  bool file_reader::awaiter::await_ready() {
+    auto& b = reader.blocks[reader.head];
+    return !b.read || b.read->aw.await_ready();
+  }
+
+  void file_reader::awaiter::await_suspend(std::coroutine_handle<> c) {
+    reader.blocks[reader.head].read->aw.await_suspend(c);
+  }
+
+  std::span<const std::byte> file_reader::awaiter::await_resume() {
+    auto& b = reader.blocks[reader.head];
+    if (!b.read)
+      return {};
+
+    auto res = b.read->aw.await_resume();
+    if (res < 0)
+      throw std::system_error(-res, std::system_category(), "read()");
+
+    // A read coming up short before the expected end means the file
+    // got shorter in the meantime, so stop there. Otherwise blocks
+    // further on would leave a gap.
+    auto offset = b.read->offset;
+    auto expected = offset < reader.end
+      ? std::min<std::uint64_t>(reader.block_size, reader.end - offset)
+      : 0;
+    auto len = std::min<std::uint64_t>(res, expected);
+    if (len < expected)
+      reader.end = reader.next_offset = offset + len;
+
+    reader.consumed = true;
+    reader.head = (reader.head + 1) % reader.depth;
+    return { b.buf.data(), static_cast<std::size_t>(len) };
+  }
+
+}
@@ -0,0 +1,128 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <covent/base.hh>
+#include <covent/fixed.hh>
+
+#include <cstdlib>
+#include <new>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+namespace covent::detail {
+
+  class fixed_buffer_pool_impl {
+    protected:
+      evloop_base& loop;
+      std::byte* memory;
+      std::size_t size;
+      unsigned count;
+      int first;
+      std::vector<unsigned> free_buffers;
+      bool orphaned = false;
+
+    public:
+      fixed_buffer_pool_impl(evloop_base& l, unsigned c, std::size_t sz)
+        : loop(l), size(sz), count(c) {
+        auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        memory = static_cast<std::byte*>(
+          std::aligned_alloc(page, (count * size + page - 1) / page * page)
+        );
+        if (memory == nullptr)
+          throw std::bad_alloc();
+
+        std::vector<iovec> iov(count);
+        for (unsigned i = 0; i < count; ++i)
+          iov[i] = { memory + i * size, size };
+
+        try {
+          first = loop.register_buffers(iov.data(), count);
+        }
+        catch (...) {
+          std::free(memory);
+          throw;
+        }
+
+        // handed out in ascending order
+        for (unsigned i = count; i > 0; --i)
+          free_buffers.push_back(i - 1);
+      }
+
+      ~fixed_buffer_pool_impl() {
+        loop.unregister_buffers(first, count);
+        std::free(memory);
+      }
+
+      fixed_buffer acquire() {
+        if (free_buffers.empty())
+          return {};
+        auto i = free_buffers.back();
+        free_buffers.pop_back();
+        return { this, memory + i * size, size, first + static_cast<int>(i) };
+      }
+
+      void release(int index) {
+        free_buffers.push_back(index - first);
+        if (orphaned && free_buffers.size() == count)
+          delete this;
+      }
+
+      void orphan() {
+        orphaned = true;
+        if (free_buffers.size() == count)
+          delete this;
+      }
+
+      std::size_t available() const noexcept {
+        return free_buffers.size();
+      }
+  };
+
+}
+
+namespace covent {
+
+  fixed_buffer::fixed_buffer(detail::fixed_buffer_pool_impl* p,
+                             std::byte* b, std::size_t l, int i) noexcept
+    : pool(p), buf(b), len(l), idx(i) {
+    /* nothing to do here */
+  }
+
+  void fixed_buffer::reset() noexcept {
+    if (pool != nullptr)
+      std::exchange(pool, nullptr)->release(idx);
+  }
+
+  fixed_buffer_pool::fixed_buffer_pool(unsigned count, std::size_t size)
+    : impl(new detail::fixed_buffer_pool_impl(
+             detail::get_active_loop(), count, size)) {
+    /* nothing to do here */
+  }
+
+  fixed_buffer_pool::~fixed_buffer_pool() {
+    if (impl != nullptr)
+      impl->orphan();
+  }
+
+  fixed_buffer fixed_buffer_pool::acquire() {
+    return impl->acquire();
+  }
+
+  std::size_t fixed_buffer_pool::available() const noexcept {
+    return impl->available();
+  }
+
+}
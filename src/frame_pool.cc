@@ -0,0 +1,90 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frame_pool.hh"
+
+#include <new>
+
+namespace covent::detail {
+
+  frame_pool::frame_pool(event_loop_stats& s, std::size_t max_size)
+    : stats(s), free_lists(size_class(max_size) + 1, nullptr) {
+    /* nothing to do here */
+  }
+
+  frame_pool::~frame_pool() {
+    auto free_list = [](free_block* block) {
+      while (block != nullptr) {
+        auto next = block->next;
+        ::operator delete(block);
+        block = next;
+      }
+    };
+
+    for (auto block : free_lists)
+      free_list(block);
+    free_list(returned.load(std::memory_order_acquire));
+  }
+
+  void* frame_pool::allocate(std::size_t size) {
+    auto cls = size_class(size);
+
+    if (cls >= free_lists.size()) {
+      ++stats.frames_fallback;
+      return nullptr;
+    }
+
+    // take over the frames handed back in the meantime
+    if (free_lists[cls] == nullptr &&
+        returned.load(std::memory_order_relaxed) != nullptr) {
+      auto block = returned.exchange(nullptr, std::memory_order_acquire);
+      while (block != nullptr) {
+        auto next = block->next;
+        block->next = free_lists[block->cls];
+        free_lists[block->cls] = block;
+        block = next;
+        ++stats.frames_returned;
+      }
+    }
+
+    if (auto block = free_lists[cls]; block != nullptr) {
+      free_lists[cls] = block->next;
+      ++stats.frames_pooled;
+      return block;
+    }
+
+    ++stats.frames_allocated;
+    return ::operator new((cls + 1) * granularity);
+  }
+
+  void frame_pool::deallocate(void* ptr, std::size_t size) noexcept {
+    auto block = static_cast<free_block*>(ptr);
+    auto cls = size_class(size);
+    block->next = free_lists[cls];
+    free_lists[cls] = block;
+  }
+
+  void frame_pool::give_back(void* ptr, std::size_t size) noexcept {
+    auto block = static_cast<free_block*>(ptr);
+    block->cls = size_class(size);
+    auto head = returned.load(std::memory_order_relaxed);
+    do {
+      block->next = head;
+    } while (!returned.compare_exchange_weak(head, block,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+  }
+
+}
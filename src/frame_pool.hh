@@ -0,0 +1,69 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_FRAME_POOL_HH
+#define COVENT_FRAME_POOL_HH
+
+#include <covent/base.hh>
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace covent::detail {
+
+  // Free lists of coroutine frames bucketed into size classes. Only the
+  // thread running the loop touches them. Frames destroyed anywhere
+  // else, like those of tasks that moved to another loop or a work
+  // pool, are pushed onto a lock-free list the loop takes over once it
+  // runs short. Frames need to be destroyed before the loop goes away.
+  class frame_pool {
+    public:
+      // size classes are multiples of this
+      static constexpr std::size_t granularity = 64;
+
+    protected:
+      struct free_block {
+          free_block* next;
+          // size class of blocks handed back from other threads
+          std::size_t cls;
+      };
+
+      event_loop_stats& stats;
+      std::vector<free_block*> free_lists;
+      std::atomic<free_block*> returned = nullptr;
+
+      std::size_t size_class(std::size_t size) const noexcept {
+        return (size + granularity - 1) / granularity - 1;
+      }
+
+    public:
+      frame_pool(event_loop_stats&, std::size_t);
+      ~frame_pool();
+
+      // not copyable
+      frame_pool(const frame_pool&) = delete;
+      frame_pool& operator=(const frame_pool&) = delete;
+
+      // returns nullptr if size exceeds the largest size class
+      void* allocate(std::size_t);
+      void deallocate(void*, std::size_t) noexcept;
+
+      // deallocate from any thread
+      void give_back(void*, std::size_t) noexcept;
+  };
+
+}
+
+#endif
@@ -21,14 +21,28 @@ namespace covent::detail {
 
   class event_awaiter_impl {
     friend class event_awaiter;
+    template<typename> friend class direct_awaiter;
 
     protected:
       std::coroutine_handle<> parent = nullptr;
 
     public:
+      virtual ~event_awaiter_impl() = default;
+
       virtual bool await_ready() = 0;
       virtual void await_suspend() = 0;
-      virtual void await_resume() = 0;
+      virtual int await_resume() = 0;
+
+      // submit right away instead of when suspending; await_ready turns
+      // true once it completed
+      virtual void start() = 0;
+
+      // complete a pending awaiter early with -ECANCELED
+      virtual void cancel() = 0;
+
+      // complete with -ETIME if not done within the given time; needs
+      // to be called before suspending
+      virtual void set_timeout(std::chrono::nanoseconds) = 0;
   };
 
 }
@@ -0,0 +1,117 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <covent/net.hh>
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+namespace covent {
+
+  socket_address socket_address::ipv4(const char* host, std::uint16_t port) {
+    socket_address addr;
+    addr.in = {};
+    addr.in.sin_family = AF_INET;
+    addr.in.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.in.sin_addr) != 1)
+      throw std::invalid_argument("invalid IPv4 address");
+    addr.len = sizeof(addr.in);
+    return addr;
+  }
+
+  socket_address socket_address::ipv6(const char* host, std::uint16_t port) {
+    socket_address addr;
+    addr.in6 = {};
+    addr.in6.sin6_family = AF_INET6;
+    addr.in6.sin6_port = htons(port);
+    if (inet_pton(AF_INET6, host, &addr.in6.sin6_addr) != 1)
+      throw std::invalid_argument("invalid IPv6 address");
+    addr.len = sizeof(addr.in6);
+    return addr;
+  }
+
+  socket_address socket_address::any(std::uint16_t port) {
+    socket_address addr;
+    addr.in = {};
+    addr.in.sin_family = AF_INET;
+    addr.in.sin_port = htons(port);
+    addr.in.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.len = sizeof(addr.in);
+    return addr;
+  }
+
+
+  static void set_option(int sock, int opt, const char* what) {
+    int enable = 1;
+    if (setsockopt(sock, SOL_SOCKET, opt, &enable, sizeof(enable)) < 0)
+      throw std::system_error(errno, std::system_category(), what);
+  }
+
+  tcp_acceptor listen_tcp(const socket_address& addr,
+                          const listen_options& opts) {
+    tcp_acceptor acc(::socket(addr.family(), SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (!acc)
+      throw std::system_error(errno, std::system_category(), "socket()");
+
+    int sock = acc.native_handle();
+
+    if (opts.reuseaddr)
+      set_option(sock, SO_REUSEADDR, "setsockopt(SO_REUSEADDR)");
+
+    if (opts.reuseport)
+      set_option(sock, SO_REUSEPORT, "setsockopt(SO_REUSEPORT)");
+
+    if (bind(sock, &addr.sa, addr.len) < 0)
+      throw std::system_error(errno, std::system_category(), "bind()");
+
+    if (listen(sock, opts.backlog) < 0)
+      throw std::system_error(errno, std::system_category(), "listen()");
+
+    return acc;
+  }
+
+  event_stream<buffer_view>
+  tcp_connection::recv_stream(const buffer_group& group,
+                              std::size_t buffer) const {
+    return detail::get_active_loop().create_event_stream(
+      op::recv_multishot { fd, group.get(), buffer, fixed }
+    );
+  }
+
+  event_stream<int>
+  tcp_acceptor::accept_stream(const accept_stream_options& opts) const {
+    return detail::get_active_loop().create_event_stream(
+      op::multishot_accept { fd, opts.flags, opts.direct, opts.buffer, fixed }
+    );
+  }
+
+  tcp_acceptor listen_tcp(std::uint16_t port, const listen_options& opts) {
+    return listen_tcp(socket_address::any(port), opts);
+  }
+
+  task<tcp_connection> connect_tcp(socket_address addr) {
+    tcp_connection conn(::socket(addr.family(), SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (!conn)
+      throw std::system_error(errno, std::system_category(), "socket()");
+
+    if (auto ret = co_await op::connect { conn.native_handle(), addr }; ret < 0)
+      throw std::system_error(-ret, std::system_category(), "connect()");
+
+    co_return std::move(conn);
+  }
+
+}
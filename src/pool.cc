@@ -0,0 +1,192 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <covent/pool.hh>
+
+#include "deque.hh"
+
+#include <algorithm>
+#include <thread>
+
+namespace covent {
+
+  struct work_pool::worker {
+      std::thread thread;
+      std::size_t index = 0;
+      detail::ws_deque queue;
+
+      // state of the xorshift picking the first victim to steal from
+      std::uint32_t rng = 0;
+
+      // only written by the worker itself
+      std::atomic<std::uint64_t> executed = 0;
+      std::atomic<std::uint64_t> steals = 0;
+      std::atomic<std::uint64_t> steal_misses = 0;
+  };
+
+  // the pool and worker the calling thread belongs to, if any
+  static thread_local work_pool* current_pool = nullptr;
+  static thread_local void* current_worker = nullptr;
+
+  static void bump(std::atomic<std::uint64_t>& counter) noexcept {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  work_pool::work_pool(unsigned threads)
+    : count(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+      workers(new worker[count]) {
+    for (std::size_t i = 0; i < count; ++i) {
+      workers[i].index = i;
+      workers[i].rng = static_cast<std::uint32_t>(i) * 2654435761u + 1;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+      workers[i].thread = std::thread([this, i]() {
+        run(workers[i]);
+      });
+    }
+  }
+
+  work_pool::~work_pool() {
+    stopping.store(true, std::memory_order_release);
+    epoch.fetch_add(1, std::memory_order_release);
+    epoch.notify_all();
+    for (std::size_t i = 0; i < count; ++i)
+      workers[i].thread.join();
+  }
+
+  void work_pool::submit(std::coroutine_handle<> c) {
+    if (current_pool == this) {
+      static_cast<worker*>(current_worker)->queue.push(c.address());
+    }
+    else {
+      std::lock_guard lock(inject_lock);
+      injected.push_back(c);
+      injected_size.fetch_add(1, std::memory_order_relaxed);
+      injected_total.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // pairs with the fence of idle workers registering as sleepers
+    // before looking for work one last time
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed) > 0) {
+      epoch.fetch_add(1, std::memory_order_release);
+      epoch.notify_one();
+    }
+  }
+
+  std::coroutine_handle<> work_pool::find_work(worker& w) {
+    if (auto p = w.queue.take(); p != nullptr)
+      return std::coroutine_handle<>::from_address(p);
+
+    if (injected_size.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard lock(inject_lock);
+      if (!injected.empty()) {
+        auto c = injected.front();
+        injected.pop_front();
+        injected_size.fetch_sub(1, std::memory_order_relaxed);
+        return c;
+      }
+    }
+
+    if (count == 1)
+      return nullptr;
+
+    // start at a random victim so thieves spread out
+    w.rng ^= w.rng << 13;
+    w.rng ^= w.rng >> 17;
+    w.rng ^= w.rng << 5;
+    auto start = w.rng % count;
+
+    for (std::size_t n = 0; n < count; ++n) {
+      auto& victim = workers[(start + n) % count];
+      if (&victim == &w)
+        continue;
+      if (auto p = victim.queue.steal(); p != nullptr) {
+        bump(w.steals);
+        return std::coroutine_handle<>::from_address(p);
+      }
+    }
+
+    bump(w.steal_misses);
+    return nullptr;
+  }
+
+  void work_pool::run(worker& w) {
+    current_pool = this;
+    current_worker = &w;
+
+    while (true) {
+      if (auto c = find_work(w)) {
+        bump(w.executed);
+        c.resume();
+        continue;
+      }
+
+      auto e = epoch.load(std::memory_order_acquire);
+      sleepers.fetch_add(1, std::memory_order_seq_cst);
+
+      if (auto c = find_work(w)) {
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+        bump(w.executed);
+        c.resume();
+        continue;
+      }
+
+      // nothing left anywhere
+      if (stopping.load(std::memory_order_acquire)) {
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+        break;
+      }
+
+      epoch.wait(e, std::memory_order_acquire);
+      sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    current_pool = nullptr;
+    current_worker = nullptr;
+  }
+
+  std::size_t work_pool::depth(std::size_t index) const noexcept {
+    return workers[index].queue.size();
+  }
+
+  work_pool_stats work_pool::stats() const noexcept {
+    work_pool_stats s;
+    s.injected = injected_total.load(std::memory_order_relaxed);
+    s.queued = injected_size.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < count; ++i) {
+      auto& w = workers[i];
+      auto d = w.queue.size();
+      s.executed += w.executed.load(std::memory_order_relaxed);
+      s.steals += w.steals.load(std::memory_order_relaxed);
+      s.steal_misses += w.steal_misses.load(std::memory_order_relaxed);
+      s.queued += d;
+      s.max_depth = std::max(s.max_depth, d);
+    }
+    return s;
+  }
+
+}
+
+namespace covent::detail {
+
+  void schedule_awaiter::await_suspend(std::coroutine_handle<> c) {
+    // the coroutine may be running on a worker before submit returns
+    origin = find_active_loop();
+    pool.submit(c);
+  }
+
+}
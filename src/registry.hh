@@ -0,0 +1,81 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_REGISTRY_HH
+#define COVENT_REGISTRY_HH
+
+#include <algorithm>
+#include <vector>
+
+namespace covent::detail {
+
+  // First fit allocator for ranges of slots in the fixed file and
+  // buffer tables. Tables are small and change rarely compared to I/O,
+  // so a sorted list of free ranges is plenty.
+  class slot_allocator {
+    protected:
+      struct range {
+        unsigned start;
+        unsigned count;
+      };
+
+      std::vector<range> free_ranges;
+
+    public:
+      void reset(unsigned size) {
+        free_ranges.clear();
+        if (size > 0)
+          free_ranges.push_back({ 0, size });
+      }
+
+      // first slot of count consecutive ones or -1 if there's no room
+      int allocate(unsigned count = 1) {
+        for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+          if (it->count < count)
+            continue;
+          auto start = it->start;
+          it->start += count;
+          it->count -= count;
+          if (it->count == 0)
+            free_ranges.erase(it);
+          return static_cast<int>(start);
+        }
+        return -1;
+      }
+
+      void release(unsigned start, unsigned count = 1) {
+        auto it = std::lower_bound(
+          free_ranges.begin(), free_ranges.end(), start,
+          [](const range& r, unsigned s) { return r.start < s; }
+        );
+        it = free_ranges.insert(it, { start, count });
+
+        // merge with the following and preceding ranges
+        if (auto next = it + 1; next != free_ranges.end() &&
+                                it->start + it->count == next->start) {
+          it->count += next->count;
+          free_ranges.erase(next);
+        }
+        if (it != free_ranges.begin()) {
+          if (auto prev = it - 1; prev->start + prev->count == it->start) {
+            prev->count += it->count;
+            free_ranges.erase(it);
+          }
+        }
+      }
+  };
+
+}
+
+#endif
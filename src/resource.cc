@@ -0,0 +1,128 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <covent/base.hh>
+#include <covent/resource.hh>
+
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unistd.h>
+#include <utility>
+
+namespace covent::detail {
+
+  // closes an entry of the fixed file table on the thread of the loop
+  // owning it
+  class fixed_closer final : public posted_work {
+    public:
+      std::shared_ptr<loop_handle> owner;
+      int index = -1;
+
+      explicit fixed_closer(std::shared_ptr<loop_handle> o) noexcept
+        : owner(std::move(o)) {
+        /* nothing to do here */
+      }
+
+      void run() override {
+        target->close_fixed(index);
+        delete this;
+      }
+  };
+
+}
+
+namespace covent {
+
+  fd_resource::fd_resource(int f, bool fx) noexcept
+    : fd(f), fixed(fx) {
+    // without memory for the closer the entry stays until the loop
+    // goes away
+    if (auto loop = detail::find_active_loop(); fixed && loop != nullptr) {
+      closer = new (std::nothrow) detail::fixed_closer(loop->handle());
+      if (closer != nullptr)
+        closer->index = fd;
+    }
+  }
+
+  fd_resource::fd_resource(fd_resource&& other) noexcept
+    : fd(other.fd), fixed(other.fixed),
+      closer(std::exchange(other.closer, nullptr)) {
+    other.fd = -1;
+  }
+
+  fd_resource& fd_resource::operator=(fd_resource&& other) noexcept {
+    if (&other != this) {
+      close();
+      fd = other.fd;
+      fixed = other.fixed;
+      closer = std::exchange(other.closer, nullptr);
+      other.fd = -1;
+    }
+    return *this;
+  }
+
+  fd_resource::~fd_resource() {
+    close();
+  }
+
+  void fd_resource::close() noexcept {
+    if (fd >= 0 && !fixed)
+      ::close(fd);
+    else if (auto c = std::exchange(closer, nullptr); c != nullptr) {
+      // the lock keeps the loop from going away in the meantime
+      auto owner = c->owner;
+      std::lock_guard lock(owner->lock);
+
+      // without a loop left, its fixed file table is gone already;
+      // one that can't be reached keeps the entry until it goes away
+      if (auto loop = owner->loop; loop == nullptr)
+        delete c;
+      else if (loop == detail::find_active_loop()) {
+        loop->close_fixed(fd);
+        delete c;
+      }
+      else {
+        try {
+          loop->post(c);
+        }
+        catch (...) {
+          delete c;
+        }
+      }
+    }
+    fd = -1;
+  }
+
+  void fd_resource::make_fixed() {
+    if (fd < 0 || fixed)
+      return;
+    auto& loop = detail::get_active_loop();
+    auto c = std::make_unique<detail::fixed_closer>(loop.handle());
+    c->index = loop.register_file(fd);
+    ::close(fd);
+    fd = c->index;
+    fixed = true;
+    closer = c.release();
+  }
+
+  event_stream<int>
+  fd_resource::poll_stream(unsigned events, std::size_t buffer) const {
+    return detail::get_active_loop().create_event_stream(
+      op::poll_multishot { fd, events, buffer, fixed }
+    );
+  }
+
+}
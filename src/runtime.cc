@@ -0,0 +1,178 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <covent/event_loop.hh>
+#include <covent/runtime.hh>
+
+#include <algorithm>
+#include <latch>
+#include <pthread.h>
+#include <sched.h>
+
+namespace covent::detail {
+
+  void spawned_base::finished() noexcept {
+    rt.workers[index].tasks.fetch_sub(1, std::memory_order_relaxed);
+    if (rt.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      rt.pending.notify_all();
+  }
+
+}
+
+namespace covent {
+
+  // suspends the main task of a loop until the runtime stops
+  class main_awaiter {
+    protected:
+      std::coroutine_handle<>& slot;
+      std::latch& ready;
+
+    public:
+      main_awaiter(std::coroutine_handle<>& s, std::latch& r) noexcept
+        : slot(s), ready(r) {
+        /* nothing to do here */
+      }
+
+      bool await_ready() const noexcept {
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> c) noexcept {
+        slot = c;
+        ready.count_down();
+      }
+
+      void await_resume() const noexcept {
+        /* nothing to do here */
+      }
+  };
+
+  // resumes the main task of a loop, ending it
+  class stop_work : public detail::posted_work {
+    protected:
+      std::coroutine_handle<> main;
+
+    public:
+      stop_work(std::coroutine_handle<> m) noexcept : main(m) {
+        /* nothing to do here */
+      }
+
+      void run() {
+        auto m = main;
+        delete this;
+        m.resume();
+      }
+  };
+
+  // pin the calling thread to the index-th core it's allowed to run on
+  static void pin_thread(std::size_t index) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+      return;
+
+    auto cpus = static_cast<std::size_t>(CPU_COUNT(&allowed));
+    if (cpus == 0)
+      return;
+
+    for (int cpu = 0, seen = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (!CPU_ISSET(cpu, &allowed))
+        continue;
+      if (static_cast<std::size_t>(seen++) == index % cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        return;
+      }
+    }
+  }
+
+  runtime::runtime(const event_loop_config& conf, unsigned threads)
+    : count(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+      workers(new worker[count]) {
+    std::latch ready(count);
+    std::vector<std::exception_ptr> errors(count);
+    auto pin = conf.get<bool>("pin", true);
+    auto evloop = conf.get<const char*>("evloop", nullptr);
+
+    for (std::size_t i = 0; i < count; ++i) {
+      workers[i].thread = std::thread([this, i, conf, pin, evloop, &ready, &errors]() {
+        if (pin)
+          pin_thread(i);
+
+        try {
+          event_loop loop { evloop, event_loop_config(conf) };
+          loop.run([&]() -> task<void> {
+            workers[i].loop = &detail::get_active_loop();
+            co_await main_awaiter(workers[i].main, ready);
+          });
+        }
+        catch (...) {
+          // only reached before the loop is up; afterwards the main
+          // task doesn't throw
+          errors[i] = std::current_exception();
+          ready.count_down();
+        }
+      });
+    }
+
+    ready.wait();
+
+    for (auto& e : errors) {
+      if (e != nullptr) {
+        stop();
+        std::rethrow_exception(e);
+      }
+    }
+  }
+
+  runtime::~runtime() {
+    wait();
+    stop();
+  }
+
+  void runtime::post(std::size_t index, detail::posted_work* w) {
+    workers[index].loop->post(w);
+  }
+
+  std::size_t runtime::least_loaded() const noexcept {
+    std::size_t best = 0;
+    for (std::size_t i = 1; i < count; ++i) {
+      if (load(i) < load(best))
+        best = i;
+    }
+    return best;
+  }
+
+  void runtime::wait() {
+    auto n = pending.load(std::memory_order_acquire);
+    while (n != 0) {
+      pending.wait(n, std::memory_order_acquire);
+      n = pending.load(std::memory_order_acquire);
+    }
+  }
+
+  void runtime::stop() {
+    for (std::size_t i = 0; i < count; ++i) {
+      if (auto& w = workers[i]; w.main != nullptr)
+        post(i, new stop_work(std::exchange(w.main, nullptr)));
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+      if (auto& w = workers[i]; w.thread.joinable())
+        w.thread.join();
+    }
+  }
+
+}
@@ -0,0 +1,167 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <covent/taskgrp.hh>
+
+namespace covent::detail {
+
+  std::coroutine_handle<> child_finished(group_child* child,
+                                         std::exception_ptr e) noexcept {
+    // the group is gone, nobody waits for the task anymore
+    if (child->group == nullptr) {
+      delete child;
+      return nullptr;
+    }
+    return child->group->finished(*child, std::move(e));
+  }
+
+}
+
+namespace covent {
+
+  task_group::wait_awaiter::~wait_awaiter() {
+    if (parent != nullptr && parent->listening() == &group)
+      parent->listen(nullptr);
+  }
+
+  void task_group::wait_awaiter::await_suspend(std::coroutine_handle<> c) {
+    group.waiting = c;
+    if (parent == nullptr)
+      return;
+    if (parent->cancelled())
+      group.cancel();
+    else
+      parent->listen(&group);
+  }
+
+  void task_group::wait_awaiter::await_resume() {
+    if (parent != nullptr && parent->listening() == &group)
+      parent->listen(nullptr);
+    if (group.error != nullptr)
+      std::rethrow_exception(group.error);
+  }
+
+
+  task_group::task_group(bool r) noexcept : race(r) {
+    /* nothing to do here */
+  }
+
+  task_group::~task_group() {
+    if (cancel_loop != nullptr)
+      cancel_loop->unschedule(&deferred_cancel);
+
+    if (running == 0)
+      return;
+
+    cancel_children();
+    for (auto& c : children) {
+      if (!c->done) {
+        c->group = nullptr;
+        c.release();
+      }
+    }
+  }
+
+  std::coroutine_handle<> task_group::finished(detail::group_child& c,
+                                               std::exception_ptr e) noexcept {
+    c.done = true;
+    --running;
+
+    auto winner = first == npos;
+    if (winner)
+      first = c.index;
+
+    if (race) {
+      if (winner) {
+        error = std::move(e);
+        defer_cancel();
+      }
+    }
+    else if (e != nullptr && error == nullptr) {
+      error = std::move(e);
+      defer_cancel();
+    }
+
+    return wake();
+  }
+
+  void task_group::defer_cancel() noexcept {
+    // Cancelling resumes the other tasks, which must not run on the
+    // stack of the one finishing, so the loop does it from its ready
+    // queue. Tasks spawned in the meantime start out cancelled.
+    cancelled = true;
+    if (cancel_loop != nullptr)
+      return;
+
+    auto loop = detail::find_active_loop();
+    if (loop == nullptr) {
+      // without a loop there is nobody to hand it to
+      cancel_children();
+      return;
+    }
+
+    deferred_cancel.group = this;
+    deferred_cancel.callback = [](detail::waiter_list* w) {
+      auto group = static_cast<cancel_node*>(w)->group;
+      group->cancel_loop = nullptr;
+      group->cancel_children();
+      if (auto c = group->wake())
+        c.resume();
+    };
+    cancel_loop = loop;
+    loop->schedule(&deferred_cancel);
+  }
+
+  void task_group::cancel_children() {
+    // tasks may finish while being cancelled; the outermost call takes
+    // care of waking up the waiter
+    if (cancelling)
+      return;
+
+    cancelled = true;
+    cancelling = true;
+    // by index, the tasks may spawn more while being cancelled
+    for (std::size_t i = 0; i < children.size(); ++i) {
+      if (!children[i]->done)
+        children[i]->token.cancel();
+    }
+    cancelling = false;
+  }
+
+  std::coroutine_handle<> task_group::wake() noexcept {
+    if (running != 0 || waiting == nullptr || cancelling)
+      return nullptr;
+    return std::exchange(waiting, nullptr);
+  }
+
+  void task_group::cancel() {
+    cancel_children();
+
+    // the waiter may only run once the caller is done with the group
+    if (auto c = wake()) {
+      if (auto loop = detail::find_active_loop(); loop != nullptr) {
+        wake_node.continuation = c;
+        loop->schedule(&wake_node);
+      }
+      else
+        c.resume();
+    }
+  }
+
+  void task_group::on_cancel() {
+    cancel();
+  }
+
+}
@@ -0,0 +1,115 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "timers.hh"
+
+#include <algorithm>
+
+namespace covent::detail {
+
+  timer_heap::timer_heap(timer_clock::duration s)
+    : slack(s) {
+    /* nothing to do here */
+  }
+
+  void timer_heap::place(std::size_t idx, timer_node* node) noexcept {
+    nodes[idx] = node;
+    node->index = idx;
+  }
+
+  void timer_heap::sift_up(std::size_t idx, timer_node* node) noexcept {
+    while (idx > 0) {
+      auto parent = (idx - 1) / 4;
+      if (nodes[parent]->deadline <= node->deadline)
+        break;
+      place(idx, nodes[parent]);
+      idx = parent;
+    }
+    place(idx, node);
+  }
+
+  void timer_heap::sift_down(std::size_t idx, timer_node* node) noexcept {
+    auto size = nodes.size();
+
+    while (true) {
+      auto first = 4 * idx + 1;
+      if (first >= size)
+        break;
+
+      // find earliest of up to four children
+      auto last = std::min(first + 4, size);
+      auto min = first;
+      for (auto child = first + 1; child < last; ++child)
+        if (nodes[child]->deadline < nodes[min]->deadline)
+          min = child;
+
+      if (node->deadline <= nodes[min]->deadline)
+        break;
+
+      place(idx, nodes[min]);
+      idx = min;
+    }
+    place(idx, node);
+  }
+
+  void timer_heap::arm(timer_node* node, timer_clock::time_point deadline) {
+    if (slack > timer_clock::duration::zero()) {
+      auto since = deadline.time_since_epoch();
+      auto rem = since % slack;
+      if (rem != timer_clock::duration::zero())
+        deadline += slack - rem;
+    }
+
+    if (node->armed())
+      cancel(node);
+
+    node->deadline = deadline;
+    node->generation = ++generation;
+    nodes.push_back(node);
+    sift_up(nodes.size() - 1, node);
+  }
+
+  void timer_heap::cancel(timer_node* node) noexcept {
+    auto idx = node->index;
+    auto last = nodes.back();
+
+    nodes.pop_back();
+    node->index = timer_node::npos;
+
+    if (last == node)
+      return;
+
+    if (idx > 0 && last->deadline < nodes[(idx - 1) / 4]->deadline)
+      sift_up(idx, last);
+    else
+      sift_down(idx, last);
+  }
+
+  std::size_t timer_heap::expire(timer_clock::time_point now) {
+    std::size_t count = 0;
+    auto limit = generation;
+
+    while (!nodes.empty() && nodes.front()->deadline <= now &&
+           nodes.front()->generation <= limit) {
+      auto node = nodes.front();
+      cancel(node);
+      node->expire();
+      ++count;
+    }
+
+    return count;
+  }
+
+}
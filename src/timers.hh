@@ -0,0 +1,90 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef COVENT_TIMERS_HH
+#define COVENT_TIMERS_HH
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace covent::detail {
+
+  using timer_clock = std::chrono::steady_clock;
+
+  // intrusive entry of the timer heap
+  class timer_node {
+    friend class timer_heap;
+
+    protected:
+      static constexpr std::size_t npos =
+        std::numeric_limits<std::size_t>::max();
+
+      timer_clock::time_point deadline;
+      std::size_t index = npos;
+
+      // arm() call of the heap that last armed this node
+      std::uint64_t generation = 0;
+
+    public:
+      virtual ~timer_node() = default;
+
+      bool armed() const noexcept {
+        return index != npos;
+      }
+
+      // called once the deadline has passed
+      virtual void expire() = 0;
+  };
+
+  // 4-ary min-heap of timers ordered by deadline. Deadlines are rounded
+  // up to a multiple of the slack, so timers close to each other expire
+  // together in a single wakeup.
+  class timer_heap {
+    protected:
+      std::vector<timer_node*> nodes;
+      timer_clock::duration slack;
+      std::uint64_t generation = 0;
+
+      void place(std::size_t, timer_node*) noexcept;
+      void sift_up(std::size_t, timer_node*) noexcept;
+      void sift_down(std::size_t, timer_node*) noexcept;
+
+    public:
+      timer_heap(timer_clock::duration = timer_clock::duration::zero());
+
+      bool empty() const noexcept {
+        return nodes.empty();
+      }
+
+      // deadline of the earliest timer; heap must not be empty
+      timer_clock::time_point next() const noexcept {
+        return nodes.front()->deadline;
+      }
+
+      void arm(timer_node*, timer_clock::time_point);
+      void cancel(timer_node*) noexcept;
+
+      // Expire timers with a deadline up to the given point in time;
+      // returns the number of expired timers. Timers armed again while
+      // expiring wait for the next call, so a ticker that is far behind
+      // or a deadline in the past can't keep the loop from the ring.
+      std::size_t expire(timer_clock::time_point);
+  };
+
+}
+
+#endif
@@ -16,49 +16,246 @@
 #include "awaiters.hh"
 #include "evloop.hh"
 
+#include <bit>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+
 namespace covent::uring {
 
-  awaiter_sqe::awaiter_sqe(evloop& l)
+  using covent::detail::timer_clock;
+
+  operation::operation(evloop& l)
     : loop(l) {
     /* nothing to do here */
   }
 
+  operation::~operation() {
+    if (queued)
+      loop.unqueue(this);
+    else if (slot != evloop::no_slot)
+      loop.abandon(this);
+  }
+
+
+  awaiter_sqe::awaiter_sqe(evloop& l)
+    : operation(l) {
+    /* nothing to do here */
+  }
+
   bool awaiter_sqe::await_ready() {
-    return false;
+    return completed;
   }
 
   void awaiter_sqe::await_suspend() {
-    setup_sqe(loop.create_sqe(this));
+    if (!started)
+      start();
+  }
+
+  void awaiter_sqe::start() {
+    started = true;
+    loop.prepare(this);
+  }
+
+  int awaiter_sqe::await_resume() {
+    return on_resume();
+  }
+
+  void awaiter_sqe::chain(std::uint8_t l, std::coroutine_handle<> c) {
+    link = l;
+    parent = c;
+    started = true;
+  }
+
+  void awaiter_sqe::cancel() {
+    cancel_requested = true;
+    if (queued) {
+      loop.unqueue(this);
+      complete(-ECANCELED, 0);
+    }
+    else if (slot != evloop::no_slot)
+      loop.cancel(this);
   }
 
-  void awaiter_sqe::await_resume() {
-    on_resume();
+  void awaiter_sqe::set_timeout(std::chrono::nanoseconds ns) {
+    linked_timeout = true;
+    timeout_ts = to_timespec(ns);
   }
 
   void awaiter_sqe::complete(res_t r, flags_t f) {
+    // an operation cancelled by its linked timeout reports -ETIME
+    if (r == -ECANCELED && linked_timeout && !cancel_requested) {
+      r = -ETIME;
+      link_expired = true;
+    }
     res = r;
     flags = f;
+    completed = true;
+    if (parent != nullptr && !parent.done())
+      parent.resume();
+  }
+
+
+  buffer_ring::buffer_ring(evloop& l, unsigned c, std::size_t sz)
+    : loop(l), count(c), size(sz) {
+    if (count == 0 || count > 32768 || !std::has_single_bit(count))
+      throw std::invalid_argument(
+        "buffer group size has to be a power of two up to 32768"
+      );
+    if (size == 0 || size > std::numeric_limits<int>::max())
+      throw std::invalid_argument("invalid buffer size");
+
+    // page aligned so the buffers don't share cache lines with anything
+    auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    memory = static_cast<std::byte*>(
+      std::aligned_alloc(page, (count * size + page - 1) / page * page)
+    );
+    if (memory == nullptr)
+      throw std::bad_alloc();
+
+    if (!loop.free_buffer_groups.empty()) {
+      bgid = loop.free_buffer_groups.back();
+      loop.free_buffer_groups.pop_back();
+    }
+    else
+      bgid = loop.next_buffer_group++;
+
+    int ret;
+    br = io_uring_setup_buf_ring(&loop.ring, count, bgid, 0, &ret);
+    if (br == nullptr) {
+      loop.free_buffer_groups.push_back(bgid);
+      std::free(memory);
+      throw std::system_error(-ret, std::system_category(),
+                              "io_uring_setup_buf_ring()");
+    }
+
+    auto mask = io_uring_buf_ring_mask(count);
+    for (unsigned id = 0; id < count; ++id)
+      io_uring_buf_ring_add(br, data(id), size, id, mask, id);
+    io_uring_buf_ring_advance(br, count);
+  }
+
+  buffer_ring::~buffer_ring() {
+    io_uring_free_buf_ring(&loop.ring, br, count, bgid);
+    loop.free_buffer_groups.push_back(bgid);
+    std::free(memory);
+  }
+
+  void buffer_ring::release(std::uint16_t id) {
+    io_uring_buf_ring_add(br, data(id), size, id,
+                          io_uring_buf_ring_mask(count), 0);
+    io_uring_buf_ring_advance(br, 1);
+  }
+
+  covent::detail::buffer_group_impl*
+  evloop::create_buffer_group(unsigned count, std::size_t size) {
+    return new buffer_ring(*this, count, size);
+  }
+
+
+  awaiter_sleep::awaiter_sleep(evloop& l, std::chrono::nanoseconds&& ns)
+    : loop(l), when(timer_clock::now() + ns) {
+    /* nothing to do here */
+  }
+
+  awaiter_sleep::awaiter_sleep(evloop& l, timer_clock::time_point&& tp)
+    : loop(l), when(tp) {
+    /* nothing to do here */
+  }
+
+  awaiter_sleep::~awaiter_sleep() {
+    if (armed())
+      loop.cancel_timer(this);
+  }
+
+  bool awaiter_sleep::await_ready() {
+    return fired;
+  }
+
+  void awaiter_sleep::await_suspend() {
+    if (!started)
+      start();
+  }
+
+  void awaiter_sleep::start() {
+    started = true;
+    loop.arm_timer(this, when);
+  }
+
+  int awaiter_sleep::await_resume() {
+    return res;
+  }
+
+  void awaiter_sleep::cancel() {
+    if (!armed())
+      return;
+    loop.cancel_timer(this);
+    res = -ECANCELED;
+    fired = true;
     if (parent != nullptr && !parent.done())
       parent.resume();
   }
 
+  void awaiter_sleep::set_timeout(std::chrono::nanoseconds ns) {
+    if (auto limit = timer_clock::now() + ns; limit < when) {
+      when = limit;
+      timed_out = true;
+    }
+  }
 
-  awaiter_sqe_sleep::awaiter_sqe_sleep(evloop& l,
-                                       std::chrono::nanoseconds&& ns)
-    : awaiter_sqe(l) {
-    auto secs = duration_cast<std::chrono::seconds>(ns);
-    ts = {
-      secs.count(),
-      (ns - secs).count()
-    };
+  void awaiter_sleep::expire() {
+    if (timed_out)
+      res = -ETIME;
+    fired = true;
+    if (parent != nullptr && !parent.done())
+      parent.resume();
   }
 
-  void awaiter_sqe_sleep::setup_sqe(io_uring_sqe* sqe) {
-    io_uring_prep_timeout(sqe, &ts, 1, 0);
+
+  stream_sqe_poll::stream_sqe_poll(evloop& l, op::poll_multishot&& o)
+    : stream_sqe(l, o.buffer), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void stream_sqe_poll::setup_sqe(io_uring_sqe* sqe) {
+    io_uring_prep_poll_multishot(sqe, op.fd, op.events);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
   }
 
-  void awaiter_sqe_sleep::on_resume() {
+  void stream_sqe_poll::on_result(res_t r, flags_t, bool more) {
+    // the kernel ends a multishot poll on its own e.g. when the ring
+    // overflowed
+    if (!more && r >= 0)
+      rearm();
+    push(r);
+  }
+
+  covent::event_stream<int>
+  evloop::create_event_stream(op::poll_multishot&& o) {
+    return covent::event_stream<int>(new stream_sqe_poll(*this, std::move(o)));
+  }
+
+
+  awaiter_sqe_timeout::awaiter_sqe_timeout(evloop& l,
+                                           std::chrono::nanoseconds since_epoch,
+                                           unsigned f)
+    : awaiter_sqe(l), ts(to_timespec(since_epoch)), timeout_flags(f) {
     /* nothing to do here */
   }
 
+  void awaiter_sqe_timeout::setup_sqe(io_uring_sqe* sqe) {
+    auto& t = loop.args_of(slot).timeout = ts;
+    io_uring_prep_timeout(sqe, &t, 0, IORING_TIMEOUT_ABS | timeout_flags);
+  }
+
+  res_t awaiter_sqe_timeout::on_resume() {
+    // reaching the deadline is success here, unlike running into the
+    // bound set by set_timeout() first
+    return res == -ETIME && !link_expired ? 0 : res;
+  }
+
 }
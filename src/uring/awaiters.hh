@@ -16,38 +16,482 @@
 #define COVENT_URING_AWAITERS_HH
 
 #include "../impl.hh"
+#include "../timers.hh"
 #include "evloop.hh"
 
 namespace covent::uring {
 
-  class awaiter_sqe : public covent::detail::event_awaiter_impl {
+  // Submission tracked by the loop from the moment its SQE is prepared
+  // (or it is queued up in the backlog waiting for space) until its
+  // final completion.
+  class operation {
+    friend class evloop;
+
     protected:
       evloop& loop;
+
+      // links into the submission backlog of the loop
+      operation* prev;
+      operation* next;
+
+      // optional IORING_OP_LINK_TIMEOUT
+      __kernel_timespec timeout_ts;
+
+      // slot in the in-flight table of the loop once submitted
+      std::uint32_t slot = evloop::no_slot;
+
+      // members ordered to keep awaiters within the inline storage
+      bool queued = false;
+      bool linked_timeout = false;
+
+      // IOSQE_IO_LINK or IOSQE_IO_HARDLINK for all but the last
+      // operation of a chain
+      std::uint8_t link = 0;
+
+    public:
+      operation(evloop&);
+      virtual ~operation();
+
+      // not copyable
+      operation(const operation&) = delete;
+      operation& operator=(const operation&) = delete;
+
+      bool pending() const noexcept {
+        return queued || slot != evloop::no_slot;
+      }
+
+      unsigned sqe_count() const noexcept {
+        return linked_timeout ? 2 : 1;
+      }
+
+      virtual void setup_sqe(io_uring_sqe*) = 0;
+      virtual void complete(res_t, flags_t) = 0;
+  };
+
+  class awaiter_sqe : public covent::detail::event_awaiter_impl,
+                      public operation {
+    protected:
       res_t res = 0;
       flags_t flags = 0;
+      bool cancel_requested = false;
+      bool started = false;
+      bool completed = false;
+
+      // ended by its linked timeout rather than on its own
+      bool link_expired = false;
 
     public:
       awaiter_sqe(evloop&);
 
+      bool await_ready() final;
+      void await_suspend() final;
+      int await_resume() final;
+
+      void start() final;
+      void cancel() final;
+      void set_timeout(std::chrono::nanoseconds) final;
+
+      // make this part of a chain that resumes c, if given, once done
+      void chain(std::uint8_t, std::coroutine_handle<>);
+
+      void complete(res_t, flags_t);
+
+      // result of the co_await expression
+      virtual res_t on_resume() {
+        return res;
+      }
+  };
+
+  // buffer group backed by a ring of provided buffers registered with
+  // io_uring_setup_buf_ring
+  class buffer_ring final : public covent::detail::buffer_group_impl {
+    protected:
+      evloop& loop;
+      io_uring_buf_ring* br;
+      std::byte* memory;
+      unsigned count;
+      std::size_t size;
+      std::uint16_t bgid;
+
+      void release(std::uint16_t);
+
+    public:
+      buffer_ring(evloop&, unsigned, std::size_t);
+      ~buffer_ring();
+
+      // return a buffer the kernel picked for an abandoned operation
+      void give_back(std::uint16_t id) {
+        release(id);
+      }
+
+      std::byte* data(std::uint16_t id) noexcept {
+        return memory + id * size;
+      }
+
+      std::uint16_t group_id() const noexcept {
+        return bgid;
+      }
+  };
+
+  class awaiter_sleep final : public covent::detail::event_awaiter_impl,
+                        public covent::detail::timer_node {
+    protected:
+      evloop& loop;
+      covent::detail::timer_clock::time_point when;
+      res_t res = 0;
+      bool timed_out = false;
+      bool started = false;
+      bool fired = false;
+
+    public:
+      awaiter_sleep(evloop&, std::chrono::nanoseconds&&);
+      awaiter_sleep(evloop&, covent::detail::timer_clock::time_point&&);
+      ~awaiter_sleep();
+
       bool await_ready();
       void await_suspend();
-      void await_resume();
+      int await_resume();
 
-      void complete(res_t, flags_t);
+      void start();
+      void cancel();
+      void set_timeout(std::chrono::nanoseconds);
 
-      virtual void setup_sqe(io_uring_sqe*) = 0;
-      virtual void on_resume() = 0;
+      void expire();
   };
 
-  class awaiter_sqe_sleep : public awaiter_sqe {
+  // absolute timeout on a kernel clock other than the monotonic one
+  class awaiter_sqe_timeout final : public awaiter_sqe {
     protected:
       __kernel_timespec ts;
+      unsigned timeout_flags;
+
+    public:
+      awaiter_sqe_timeout(evloop&, std::chrono::nanoseconds, unsigned);
+
+      void setup_sqe(io_uring_sqe*);
+      res_t on_resume();
+  };
+
+  class awaiter_sqe_accept final : public awaiter_sqe {
+    protected:
+      op::accept op;
+
+    public:
+      awaiter_sqe_accept(evloop&, op::accept&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_connect final : public awaiter_sqe {
+    protected:
+      op::connect op;
+
+    public:
+      awaiter_sqe_connect(evloop&, op::connect&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_recv final : public awaiter_sqe {
+    protected:
+      op::recv op;
+
+    public:
+      awaiter_sqe_recv(evloop&, op::recv&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  // A zero copy send reports its result first and notifies once the
+  // pages aren't referenced anymore; it resumes only then, so the memory
+  // may be reused right away.
+  class awaiter_sqe_zc : public awaiter_sqe {
+    protected:
+      res_t sent = 0;
+
+    public:
+      using awaiter_sqe::awaiter_sqe;
+      void complete(res_t, flags_t);
+  };
+
+  class awaiter_sqe_send final : public awaiter_sqe_zc {
+    protected:
+      op::send op;
+
+    public:
+      awaiter_sqe_send(evloop&, op::send&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_sendmsg final : public awaiter_sqe_zc {
+    protected:
+      op::sendmsg op;
+
+    public:
+      awaiter_sqe_sendmsg(evloop&, op::sendmsg&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_shutdown final : public awaiter_sqe {
+    protected:
+      op::shutdown op;
+
+    public:
+      awaiter_sqe_shutdown(evloop&, op::shutdown&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_read final : public awaiter_sqe {
+    protected:
+      op::read op;
+
+    public:
+      awaiter_sqe_read(evloop&, op::read&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_write final : public awaiter_sqe {
+    protected:
+      op::write op;
+
+    public:
+      awaiter_sqe_write(evloop&, op::write&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_writev final : public awaiter_sqe {
+    protected:
+      op::writev op;
+
+    public:
+      awaiter_sqe_writev(evloop&, op::writev&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_openat final : public awaiter_sqe {
+    protected:
+      op::openat op;
+
+    public:
+      awaiter_sqe_openat(evloop&, op::openat&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_fsync final : public awaiter_sqe {
+    protected:
+      op::fsync op;
+
+    public:
+      awaiter_sqe_fsync(evloop&, op::fsync&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_fallocate final : public awaiter_sqe {
+    protected:
+      op::fallocate op;
+
+    public:
+      awaiter_sqe_fallocate(evloop&, op::fallocate&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_statx final : public awaiter_sqe {
+    protected:
+      op::statx op;
+
+    public:
+      awaiter_sqe_statx(evloop&, op::statx&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class awaiter_sqe_close final : public awaiter_sqe {
+    protected:
+      op::close op;
+
+    public:
+      awaiter_sqe_close(evloop&, op::close&&);
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  // Operation completing many times from a single submission, feeding
+  // an event stream. Completions flagged IORING_CQE_F_MORE leave the
+  // operation armed and go straight into the stream's buffer; the
+  // stream pauses it while the buffer is full. Being stopped on
+  // purpose is handled here, all other completions by on_result.
+  template<typename T>
+  class stream_sqe : public covent::detail::event_stream_impl<T>,
+                     public operation {
+    protected:
+      bool stopping = false;
+
+      // handle a completion; more is set if the operation stays armed
+      virtual void on_result(res_t, flags_t, bool more) = 0;
+
+      // arm again after the kernel ended the operation on its own,
+      // unless the consumer has enough buffered
+      void rearm() {
+        if (!this->paused)
+          start();
+      }
+
+    public:
+      stream_sqe(evloop& l, std::size_t buffer)
+        : covent::detail::event_stream_impl<T>(buffer), operation(l) {
+        /* nothing to do here */
+      }
+
+      void start() {
+        loop.prepare(this);
+      }
+
+      void stop() {
+        if (queued)
+          loop.unqueue(this);
+        else if (slot != evloop::no_slot) {
+          stopping = true;
+          loop.cancel(this);
+        }
+      }
+
+      bool active() const {
+        return pending();
+      }
+
+      void complete(res_t r, flags_t f) {
+        auto more = (f & IORING_CQE_F_MORE) != 0;
+
+        // stopped to pause; start over once the consumer caught up
+        if (!more && std::exchange(stopping, false) && r == -ECANCELED) {
+          rearm();
+          return;
+        }
+
+        on_result(r, f, more);
+      }
+  };
+
+  class stream_sqe_accept final : public stream_sqe<int> {
+    protected:
+      op::multishot_accept op;
+
+      void on_result(res_t, flags_t, bool);
+
+    public:
+      stream_sqe_accept(evloop&, op::multishot_accept&&);
+      ~stream_sqe_accept();
+
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class stream_sqe_recv final : public stream_sqe<covent::buffer_view> {
+    protected:
+      op::recv_multishot op;
+
+      void on_result(res_t, flags_t, bool);
+
+    public:
+      stream_sqe_recv(evloop&, op::recv_multishot&&);
+      ~stream_sqe_recv();
+
+      void setup_sqe(io_uring_sqe*);
+  };
+
+  class stream_sqe_poll final : public stream_sqe<int> {
+    protected:
+      op::poll_multishot op;
+
+      void on_result(res_t, flags_t, bool);
 
     public:
-      awaiter_sqe_sleep(evloop&, std::chrono::nanoseconds&&);
+      stream_sqe_poll(evloop&, op::poll_multishot&&);
 
       void setup_sqe(io_uring_sqe*);
-      void on_resume();
+  };
+
+}
+
+namespace covent::detail {
+
+  // awaiters created right in the awaiting coroutine, for builds using
+  // the io_uring loop exclusively
+  template<>
+  struct awaiter_factory<uring::evloop> {
+      template<typename ImplType, typename ...Args>
+      static direct_awaiter<ImplType> make(evloop_base& loop, Args&& ...args) {
+        return {
+          std::in_place, static_cast<uring::evloop&>(loop),
+          std::forward<Args>(args)...
+        };
+      }
+
+      static auto create(evloop_base& l, std::chrono::nanoseconds&& ns) {
+        return make<uring::awaiter_sleep>(l, std::move(ns));
+      }
+
+      static auto create(evloop_base& l, std::chrono::steady_clock::time_point&& tp) {
+        return make<uring::awaiter_sleep>(l, std::move(tp));
+      }
+
+      static auto create(evloop_base& l, std::chrono::system_clock::time_point&& tp) {
+        return make<uring::awaiter_sqe_timeout>(l, tp.time_since_epoch(), IORING_TIMEOUT_REALTIME);
+      }
+
+      static auto create(evloop_base& l, boot_clock::time_point&& tp) {
+        return make<uring::awaiter_sqe_timeout>(l, tp.time_since_epoch(), IORING_TIMEOUT_BOOTTIME);
+      }
+
+      static auto create(evloop_base& l, op::accept&& o) {
+        return make<uring::awaiter_sqe_accept>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::connect&& o) {
+        return make<uring::awaiter_sqe_connect>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::recv&& o) {
+        return make<uring::awaiter_sqe_recv>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::send&& o) {
+        return make<uring::awaiter_sqe_send>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::sendmsg&& o) {
+        return make<uring::awaiter_sqe_sendmsg>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::shutdown&& o) {
+        return make<uring::awaiter_sqe_shutdown>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::read&& o) {
+        return make<uring::awaiter_sqe_read>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::write&& o) {
+        return make<uring::awaiter_sqe_write>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::writev&& o) {
+        return make<uring::awaiter_sqe_writev>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::openat&& o) {
+        return make<uring::awaiter_sqe_openat>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::fsync&& o) {
+        return make<uring::awaiter_sqe_fsync>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::fallocate&& o) {
+        return make<uring::awaiter_sqe_fallocate>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::statx&& o) {
+        return make<uring::awaiter_sqe_statx>(l, std::move(o));
+      }
+
+      static auto create(evloop_base& l, op::close&& o) {
+        return make<uring::awaiter_sqe_close>(l, std::move(o));
+      }
   };
 
 }
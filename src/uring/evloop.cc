@@ -13,68 +13,555 @@
  * limitations under the License.
  */
 
+#include <covent/event_loop.hh>
+
 #include "awaiters.hh"
 #include "evloop.hh"
 
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+
 namespace covent {
 
-  // explictly instantiate constructor for event loop implementation
-  template<>
-  event_loop::event_loop<evloop_uring>(const event_loop_config&& conf)
-    : impl(new evloop_uring(std::move(conf))) {
-    /* nothing to to here */
+  // create the event loop implementation
+  template<> template<>
+  detail::evloop_base*
+  event_loop::create<evloop_uring>(const event_loop_config&& conf) {
+    return new evloop_uring(std::move(conf));
   }
 
 }
 
 namespace covent::uring {
 
+  using covent::detail::timer_clock;
   using covent::detail::event_awaiter;
+  using covent::detail::posted_work;
+
+  // failures of sending a message that are worth another try
+  static bool transient(res_t res) noexcept {
+    return res == -EAGAIN || res == -EBUSY;
+  }
+
+  // Ring used to send messages from threads not running a loop. Each
+  // message is sent on its own and its completion waited for, so no
+  // failure goes unnoticed.
+  class sender_ring {
+    public:
+      io_uring ring = {};
+
+      sender_ring() {
+        if (auto ret = io_uring_queue_init(4, &ring, 0); ret < 0)
+          throw std::system_error(-ret, std::system_category(),
+                                  "io_uring_queue_init()");
+      }
+
+      ~sender_ring() {
+        io_uring_queue_exit(&ring);
+      }
+
+      void send(int fd, std::uint64_t data) {
+        while (true) {
+          auto sqe = io_uring_get_sqe(&ring);
+          io_uring_prep_msg_ring(sqe, fd, 0, data, 0);
 
-  evloop::evloop(const event_loop_config&& conf) {
+          io_uring_cqe* cqe;
+          auto ret = io_uring_submit_and_wait(&ring, 1);
+          while (ret == -EINTR)
+            ret = io_uring_wait_cqe(&ring, &cqe);
+          if (ret < 0)
+            throw std::system_error(-ret, std::system_category(),
+                                    "io_uring_submit_and_wait()");
+
+          io_uring_peek_cqe(&ring, &cqe);
+          auto res = cqe->res;
+          io_uring_cqe_seen(&ring, cqe);
+
+          if (res >= 0)
+            return;
+          if (!transient(res))
+            throw std::system_error(-res, std::system_category(),
+                                    "IORING_OP_MSG_RING");
+          std::this_thread::yield();
+        }
+      }
+  };
+
+  evloop::evloop(const event_loop_config&& conf)
+    : evloop_base(conf),
+      cqe_budget(conf.get<int, unsigned>("cqe_budget", 1024)),
+      timers(std::chrono::nanoseconds(conf.get<int>("timer_slack", 0))) {
     io_uring_params params = {};
-    io_uring_queue_init_params(
-      conf.get<int, uint32_t>("entries", 256),
-      &ring, &params
-    );
+
+    // kernel side submission queue polling; idle time in milliseconds
+    // before the polling thread goes to sleep
+    if (conf.get<bool>("sqpoll", false)) {
+      params.flags |= IORING_SETUP_SQPOLL;
+      params.sq_thread_idle = conf.get<int, uint32_t>("sqpoll_idle", 1000);
+      if (auto cpu = conf.get<int>("sqpoll_cpu", -1); cpu >= 0) {
+        params.flags |= IORING_SETUP_SQ_AFF;
+        params.sq_thread_cpu = cpu;
+      }
+    }
+
+    // deferred task running requires a single issuer
+    if (conf.get<bool>("defer_taskrun", false))
+      params.flags |= IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+
+    if (conf.get<bool>("single_issuer", false))
+      params.flags |= IORING_SETUP_SINGLE_ISSUER;
+
+    if (conf.get<bool>("coop_taskrun", false))
+      params.flags |= IORING_SETUP_COOP_TASKRUN;
+
+    // completion queue size independent of the submission queue
+    if (auto cq = conf.get<int>("cq_entries", 0); cq > 0) {
+      params.flags |= IORING_SETUP_CQSIZE;
+      params.cq_entries = cq;
+    }
+
+    if (auto ret = io_uring_queue_init_params(
+          conf.get<int, uint32_t>("entries", 256),
+          &ring, &params); ret < 0)
+      throw std::system_error(-ret, std::system_category(),
+                              "io_uring_queue_init_params()");
+
+    // Sparse fixed file table: registered_files slots managed by the
+    // registry, then files slots for direct descriptors allocated by
+    // the kernel.
+    registered_files = conf.get<int>("registered_files", 0);
+    auto files = conf.get<int>("files", 0);
+    file_slots.reset(registered_files);
+
+    auto fail = [this](int ret, const char* what) {
+      io_uring_queue_exit(&ring);
+      throw std::system_error(-ret, std::system_category(), what);
+    };
+
+    if (registered_files + files > 0) {
+      if (auto ret = io_uring_register_files_sparse(
+            &ring, registered_files + files); ret < 0)
+        fail(ret, "io_uring_register_files_sparse()");
+    }
+
+    if (registered_files > 0 && files > 0) {
+      if (auto ret = io_uring_register_file_alloc_range(
+            &ring, registered_files, files); ret < 0)
+        fail(ret, "io_uring_register_file_alloc_range()");
+    }
+
+    // sparse fixed buffer table
+    if (auto buffers = conf.get<int>("registered_buffers", 0); buffers > 0) {
+      if (auto ret = io_uring_register_buffers_sparse(&ring, buffers); ret < 0)
+        fail(ret, "io_uring_register_buffers_sparse()");
+      buffer_slots.reset(buffers);
+    }
   }
 
   evloop::~evloop() {
+    retire();
+
+    // let go of groups whose abandoned receives never completed
+    for (auto& a : args)
+      if (a.group != nullptr)
+        a.group->unpin();
     io_uring_queue_exit(&ring);
   }
 
+  static_assert(sizeof(awaiter_sleep) <= event_awaiter::storage_size,
+                "awaiter_sleep doesn't fit the inline storage");
+  static_assert(sizeof(awaiter_sqe_timeout) <= event_awaiter::storage_size,
+                "awaiter_sqe_timeout doesn't fit the inline storage");
+
   event_awaiter evloop::create_event_awaiter(std::chrono::nanoseconds&& ns) {
-    return { new awaiter_sqe_sleep(*this, std::move(ns)) };
+    return { *this, std::in_place_type<awaiter_sleep>, *this, std::move(ns) };
   }
 
-  inline void handle_cqe(io_uring* ring, io_uring_cqe* cqe) {
-    auto aw = static_cast<awaiter_sqe*>(io_uring_cqe_get_data(cqe));
-    aw->complete(cqe->res, cqe->flags);
-    io_uring_cqe_seen(ring, cqe);
+  event_awaiter evloop::create_event_awaiter(std::chrono::steady_clock::time_point&& tp) {
+    return { *this, std::in_place_type<awaiter_sleep>, *this, std::move(tp) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(std::chrono::system_clock::time_point&& tp) {
+    return {
+      *this, std::in_place_type<awaiter_sqe_timeout>, *this,
+      tp.time_since_epoch(), IORING_TIMEOUT_REALTIME
+    };
+  }
+
+  event_awaiter evloop::create_event_awaiter(covent::boot_clock::time_point&& tp) {
+    return {
+      *this, std::in_place_type<awaiter_sqe_timeout>, *this,
+      tp.time_since_epoch(), IORING_TIMEOUT_BOOTTIME
+    };
+  }
+
+  void evloop::handle_cqe(io_uring_cqe* cqe) {
+    auto data = io_uring_cqe_get_data64(cqe);
+    if (data == 0)
+      return;
+
+    if (data & message_tag) {
+      handle_message(
+        reinterpret_cast<posted_work*>(data & ~message_tag), cqe->res
+      );
+      return;
+    }
+
+    auto slot = static_cast<std::uint32_t>(data - 1);
+    auto o = inflight[slot];
+
+    // the final completion of an operation releases its slot
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      inflight[slot] = nullptr;
+      free_slots.push_back(slot);
+      if (o != nullptr)
+        o->slot = no_slot;
+
+      // nothing left to cancel, and the slot may be reused
+      if (!pending_cancels.empty())
+        std::erase(pending_cancels, slot);
+    }
+
+    if (o != nullptr)
+      o->complete(cqe->res, cqe->flags);
+    else {
+      ++stats.completions_dropped;
+
+      // nobody takes the buffers picked for an abandoned receive
+      if (auto& group = args[slot].group; group != nullptr) {
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+          group->give_back(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+          std::exchange(group, nullptr)->unpin();
+      }
+    }
   }
 
   void evloop::run_once() {
+    // coroutines woken up by the previous round go first, then their
+    // submissions
+    auto resumed = run_ready();
+    drain_backlog();
+
+    // submit and wait with a single system call unless there already
+    // are completions to handle, in which case SQPOLL rings don't need
+    // to enter the kernel at all; also don't wait while awaiters are
+    // still queued up for submission or coroutines ran or are ready to
+    // run. The earliest timer bounds the wait.
+    int ret;
+
+    if (io_uring_cq_ready(&ring) || backlog_head != nullptr ||
+        !pending_cancels.empty() || resumed > 0 || has_ready())
+      ret = io_uring_submit(&ring);
+    else if (timers.empty())
+      ret = io_uring_submit_and_wait(&ring, 1);
+    else if (auto wait = timers.next() - timer_clock::now(); wait > wait.zero()) {
+      io_uring_cqe* cqe;
+      auto ts = to_timespec(wait);
+      ret = io_uring_submit_and_wait_timeout(&ring, &cqe, 1, &ts, nullptr);
+    }
+    else
+      ret = io_uring_submit(&ring);
+
+    if (ret < 0 && ret != -EINTR && ret != -EBUSY && ret != -ETIME)
+      throw std::system_error(-ret, std::system_category(),
+                              "io_uring_submit_and_wait()");
+
+    // reap completions in batches, advancing the completion queue head
+    // once per batch, and keep going while more arrive until the budget
+    // is used up
+    io_uring_cqe* cqes[cqe_batch_size];
+    unsigned handled = 0;
+
+    while (handled < cqe_budget) {
+      auto count = io_uring_peek_batch_cqe(&ring, cqes, cqe_batch_size);
+      if (count == 0)
+        break;
+      for (unsigned i = 0; i < count; ++i)
+        handle_cqe(cqes[i]);
+      io_uring_cq_advance(&ring, count);
+      handled += count;
+    }
+
+    if (!timers.empty())
+      timers.expire(timer_clock::now());
+  }
+
+  io_uring_sqe* evloop::get_sqe() {
+    if (auto sqe = io_uring_get_sqe(&ring); sqe != nullptr)
+      return sqe;
+
+    // submission queue is full: flush it to the kernel and retry; the
+    // SQ thread of an SQPOLL ring makes room in its own time
+    ++stats.sq_full;
     io_uring_submit(&ring);
-    io_uring_cqe* cqe;
+    if (ring.flags & IORING_SETUP_SQPOLL)
+      io_uring_sqring_wait(&ring);
+    return io_uring_get_sqe(&ring);
+  }
 
-    // handle all completed without waiting
-    while (!io_uring_peek_cqe(&ring, &cqe))
-      handle_cqe(&ring, cqe);
+  bool evloop::reserve(unsigned count) {
+    if (io_uring_sq_space_left(&ring) >= count)
+      return true;
 
-    // then actually wait for one
-    io_uring_wait_cqe(&ring, &cqe);
-    handle_cqe(&ring, cqe);
+    // submission queue is full: flush it to the kernel and recheck
+    ++stats.sq_full;
+    io_uring_submit(&ring);
+    return io_uring_sq_space_left(&ring) >= count;
   }
 
-  io_uring_sqe* evloop::create_sqe(awaiter_sqe* aw) {
-    io_uring_sqe* sqe = io_uring_get_sqe(&ring);
-    if (sqe == nullptr) {
-      // handle overflow
+  void evloop::prepare_sqe(operation* o) {
+    if (free_slots.empty()) {
+      o->slot = inflight.size();
+      inflight.push_back(o);
+      args.emplace_back();
     }
     else {
-      io_uring_sqe_set_data(sqe, aw);
+      o->slot = free_slots.back();
+      free_slots.pop_back();
+      inflight[o->slot] = o;
     }
-    return sqe;
+
+    auto sqe = io_uring_get_sqe(&ring);
+    o->setup_sqe(sqe);
+    io_uring_sqe_set_data64(sqe, o->slot + 1);
+
+    if (o->link)
+      io_uring_sqe_set_flags(sqe, sqe->flags | o->link);
+
+    // the timeout sits between the operation and the next one of a
+    // chain, so it carries the link on
+    if (o->linked_timeout) {
+      io_uring_sqe_set_flags(sqe, sqe->flags | IOSQE_IO_LINK);
+      auto& ts = args[o->slot].link_timeout = o->timeout_ts;
+      auto tsqe = io_uring_get_sqe(&ring);
+      io_uring_prep_link_timeout(tsqe, &ts, 0);
+      io_uring_sqe_set_data64(tsqe, 0);
+      io_uring_sqe_set_flags(tsqe, o->link);
+    }
+  }
+
+  void evloop::prepare(operation* o) {
+    // once there is a backlog new awaiters need to queue up behind it
+    // to keep submission order
+    if (backlog_head == nullptr && reserve(o->sqe_count())) {
+      prepare_sqe(o);
+      return;
+    }
+
+    enqueue(o);
+  }
+
+  void evloop::enqueue(operation* o) {
+    ++stats.sq_backlogged;
+    o->queued = true;
+    o->prev = backlog_tail;
+    o->next = nullptr;
+    if (backlog_tail != nullptr)
+      backlog_tail->next = o;
+    else
+      backlog_head = o;
+    backlog_tail = o;
+  }
+
+  void evloop::unqueue(operation* o) {
+    if (o->prev != nullptr)
+      o->prev->next = o->next;
+    else
+      backlog_head = o->next;
+    if (o->next != nullptr)
+      o->next->prev = o->prev;
+    else
+      backlog_tail = o->prev;
+    o->queued = false;
+  }
+
+  void evloop::drain_backlog() {
+    while (!pending_cancels.empty()) {
+      if (!submit_cancel(pending_cancels.back()))
+        return;
+      pending_cancels.pop_back();
+    }
+
+    while (backlog_head != nullptr) {
+      // the operations of a chain need to be submitted all at once, or
+      // the kernel ends the chain early
+      auto last = backlog_head;
+      unsigned count = last->sqe_count();
+      while (last->link && last->next != nullptr) {
+        last = last->next;
+        count += last->sqe_count();
+      }
+
+      if (io_uring_sq_space_left(&ring) < count)
+        break;
+
+      operation* o;
+      do {
+        o = backlog_head;
+        unqueue(o);
+        prepare_sqe(o);
+      } while (o != last);
+    }
+  }
+
+  void evloop::submit_chain(event_awaiter* aws, std::size_t count, bool hard,
+                            std::coroutine_handle<> c) {
+    auto op_at = [aws](std::size_t i) {
+      auto o = dynamic_cast<awaiter_sqe*>(impl_of(aws[i]));
+      if (o == nullptr)
+        throw std::invalid_argument(
+          "only submission queue based operations can be chained"
+        );
+      return o;
+    };
+
+    // check all of them before marking any as part of a chain
+    unsigned sqes = 0;
+    for (std::size_t i = 0; i < count; ++i)
+      sqes += op_at(i)->sqe_count();
+
+    if (sqes > ring.sq.ring_entries)
+      throw std::length_error("chain longer than the submission queue");
+
+    // only the last operation resumes; the kernel completes linked
+    // operations in order, so all others are done by then
+    for (std::size_t i = 0; i < count; ++i) {
+      if (i + 1 < count)
+        op_at(i)->chain(hard ? IOSQE_IO_HARDLINK : IOSQE_IO_LINK, nullptr);
+      else
+        op_at(i)->chain(0, c);
+    }
+
+    if (backlog_head == nullptr && reserve(sqes)) {
+      for (std::size_t i = 0; i < count; ++i)
+        prepare_sqe(op_at(i));
+    }
+    else {
+      for (std::size_t i = 0; i < count; ++i)
+        enqueue(op_at(i));
+    }
+  }
+
+  void evloop::post(posted_work* w) {
+    w->target = this;
+    auto data = reinterpret_cast<std::uint64_t>(w) | message_tag;
+
+    // The message shows up as a completion on this ring, waking it up
+    // if it's waiting. Loops send from their own ring as part of their
+    // next submission and only see a completion, carrying the same
+    // user_data, if sending failed.
+    if (auto sender = dynamic_cast<evloop*>(covent::detail::find_active_loop());
+        sender != nullptr) {
+      if (auto sqe = sender->get_sqe(); sqe != nullptr) {
+        io_uring_prep_msg_ring(sqe, ring.ring_fd, 0, data, 0);
+        io_uring_sqe_set_data64(sqe, data);
+        io_uring_sqe_set_flags(sqe, IOSQE_CQE_SKIP_SUCCESS);
+        return;
+      }
+    }
+
+    thread_local sender_ring sr;
+    sr.send(ring.ring_fd, data);
+  }
+
+  void evloop::handle_message(posted_work* w, res_t res) {
+    if (res >= 0) {
+      w->run();
+      return;
+    }
+
+    // A message this ring failed to send. Only a busy target is worth
+    // another try; one that overflowed or went away may never take it,
+    // and its work item is given up on.
+    if (transient(res))
+      w->target->post(w);
+    else
+      ++stats.messages_dropped;
+  }
+
+  bool evloop::submit_cancel(std::uint32_t slot) {
+    auto sqe = get_sqe();
+    if (sqe == nullptr)
+      return false;
+    io_uring_prep_cancel64(sqe, slot + 1, 0);
+    io_uring_sqe_set_data64(sqe, 0);
+    return true;
+  }
+
+  void evloop::cancel(operation* o) {
+    // The operation completes with -ECANCELED if it was still pending.
+    // Without room in the submission queue the cancellation is retried
+    // with the next round, unless the final completion comes first.
+    if (!submit_cancel(o->slot))
+      pending_cancels.push_back(o->slot);
+  }
+
+  int evloop::register_file(int fd) {
+    auto index = file_slots.allocate();
+    if (index < 0)
+      throw std::system_error(ENFILE, std::system_category(),
+                              "no free fixed file slot");
+    if (auto ret = io_uring_register_files_update(&ring, index, &fd, 1); ret < 0) {
+      file_slots.release(index);
+      throw std::system_error(-ret, std::system_category(),
+                              "io_uring_register_files_update()");
+    }
+    return index;
+  }
+
+  void evloop::unregister_file(int index) {
+    // operations still using the file hold on to it in the kernel
+    int fd = -1;
+    io_uring_register_files_update(&ring, index, &fd, 1);
+    file_slots.release(index);
+  }
+
+  int evloop::register_buffers(const iovec* iov, unsigned count) {
+    auto first = buffer_slots.allocate(count);
+    if (first < 0)
+      throw std::system_error(ENOBUFS, std::system_category(),
+                              "no free fixed buffer slots");
+    if (auto ret = io_uring_register_buffers_update_tag(
+          &ring, first, iov, nullptr, count); ret < 0) {
+      buffer_slots.release(first, count);
+      throw std::system_error(-ret, std::system_category(),
+                              "io_uring_register_buffers_update_tag()");
+    }
+    return first;
+  }
+
+  void evloop::unregister_buffers(int first, unsigned count) {
+    std::vector<iovec> empty(count, iovec { nullptr, 0 });
+    io_uring_register_buffers_update_tag(
+      &ring, first, empty.data(), nullptr, count
+    );
+    buffer_slots.release(first, count);
+  }
+
+  void evloop::close_fixed(int index) {
+    // registry slots are released right away so they can't be reused
+    // while an asynchronous close is still pending
+    if (index < registered_files) {
+      unregister_file(index);
+      return;
+    }
+
+    if (auto sqe = get_sqe(); sqe != nullptr) {
+      io_uring_prep_close_direct(sqe, index);
+      io_uring_sqe_set_data64(sqe, 0);
+    }
+  }
+
+  void evloop::abandon(operation* o) {
+    // the arguments the kernel reads live with the slot, which stays
+    // taken until the final completion arrives
+    cancel(o);
+    inflight[o->slot] = nullptr;
+    o->slot = no_slot;
   }
 
 }
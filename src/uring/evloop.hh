@@ -16,27 +16,163 @@
 #define COVENT_URING_EVLOOP_HH
 
 #include <covent/base.hh>
-#include <covent/event_loop.hh>
 #include <liburing.h>
 
+#include "../timers.hh"
+#include "../registry.hh"
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <vector>
+
 namespace covent::uring {
 
   using res_t = __s32;
   using flags_t = __u32;
 
-  class awaiter_sqe;
+  inline __kernel_timespec to_timespec(std::chrono::nanoseconds ns) {
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(ns);
+    return { secs.count(), (ns - secs).count() };
+  }
+
+  class buffer_ring;
+  class operation;
+
+  class evloop final : public covent::detail::evloop_base {
+    friend class buffer_ring;
+
+    public:
+      static constexpr std::uint32_t no_slot =
+        std::numeric_limits<std::uint32_t>::max();
+
+      // user_data of messages from other rings carrying a pointer to
+      // posted work; slots never get anywhere near this
+      static constexpr std::uint64_t message_tag = std::uint64_t(1) << 63;
+
+      // Arguments the kernel reads through pointers of an SQE live with
+      // the slot rather than in the awaiter. The SQ thread of an SQPOLL
+      // ring may read them any time until it consumed the SQE, and the
+      // slot of a destroyed awaiter is only released by its final
+      // completion, so they stay valid that long.
+      struct slot_args {
+          __kernel_timespec link_timeout;
+          __kernel_timespec timeout;
+          covent::socket_address addr;
+
+          // group of an abandoned receive selecting buffers
+          buffer_ring* group = nullptr;
+      };
 
-  class evloop : public covent::detail::evloop_base {
     private:
+      // completions reaped per io_uring_peek_batch_cqe call
+      static constexpr unsigned cqe_batch_size = 64;
+
       io_uring ring = {};
+      unsigned cqe_budget;
+
+      // user space timers; the earliest one bounds the wait for
+      // completions, so no timeout SQEs are needed for sleeping
+      covent::detail::timer_heap timers;
+
+      // awaiters waiting for space in the submission queue
+      operation* backlog_head = nullptr;
+      operation* backlog_tail = nullptr;
+
+      // Submitted awaiters indexed by slot; user_data carries slot + 1
+      // and zero marks completions nobody waits for. Destroyed awaiters
+      // leave a nullptr behind until their final completion arrives,
+      // so the loop never touches freed memory.
+      std::vector<operation*> inflight;
+      std::vector<std::uint32_t> free_slots;
+
+      // argument storage by slot, see slot_args
+      std::deque<slot_args> args;
+
+      // slots of cancellations that found the submission queue full
+      std::vector<std::uint32_t> pending_cancels;
+
+      // Slots of the fixed file table handed out by the registry. They
+      // come first, followed by the ones the kernel allocates for direct
+      // descriptors.
+      covent::detail::slot_allocator file_slots;
+      int registered_files = 0;
+
+      // slots of the fixed buffer table
+      covent::detail::slot_allocator buffer_slots;
+
+      // ids of provided buffer groups given back by destroyed groups
+      std::vector<std::uint16_t> free_buffer_groups;
+      std::uint16_t next_buffer_group = 0;
+
+      io_uring_sqe* get_sqe();
+      bool reserve(unsigned);
+      void prepare_sqe(operation*);
+      void enqueue(operation*);
+      void drain_backlog();
+      bool submit_cancel(std::uint32_t);
+      void handle_cqe(io_uring_cqe*);
+      void handle_message(covent::detail::posted_work*, res_t);
 
     public:
       evloop(const covent::event_loop_config&&);
       ~evloop();
 
       void run_once();
-      io_uring_sqe* create_sqe(awaiter_sqe*);
+      void prepare(operation*);
+      void unqueue(operation*);
+      void cancel(operation*);
+      void abandon(operation*);
+
+      // argument storage of a prepared operation
+      slot_args& args_of(std::uint32_t slot) noexcept {
+        return args[slot];
+      }
+
+      void arm_timer(covent::detail::timer_node* node,
+                     covent::detail::timer_clock::time_point when) {
+        timers.arm(node, when);
+      }
+
+      void cancel_timer(covent::detail::timer_node* node) noexcept {
+        timers.cancel(node);
+      }
+
       covent::detail::event_awaiter create_event_awaiter(std::chrono::nanoseconds&&);
+      covent::detail::event_awaiter create_event_awaiter(std::chrono::steady_clock::time_point&&);
+      covent::detail::event_awaiter create_event_awaiter(std::chrono::system_clock::time_point&&);
+      covent::detail::event_awaiter create_event_awaiter(covent::boot_clock::time_point&&);
+      covent::detail::event_awaiter create_event_awaiter(op::accept&&);
+      covent::detail::event_awaiter create_event_awaiter(op::connect&&);
+      covent::detail::event_awaiter create_event_awaiter(op::recv&&);
+      covent::detail::event_awaiter create_event_awaiter(op::send&&);
+      covent::detail::event_awaiter create_event_awaiter(op::sendmsg&&);
+      covent::detail::event_awaiter create_event_awaiter(op::writev&&);
+      covent::detail::event_awaiter create_event_awaiter(op::read&&);
+      covent::detail::event_awaiter create_event_awaiter(op::write&&);
+      covent::detail::event_awaiter create_event_awaiter(op::openat&&);
+      covent::detail::event_awaiter create_event_awaiter(op::fsync&&);
+      covent::detail::event_awaiter create_event_awaiter(op::fallocate&&);
+      covent::detail::event_awaiter create_event_awaiter(op::statx&&);
+      covent::detail::event_awaiter create_event_awaiter(op::close&&);
+      covent::detail::event_awaiter create_event_awaiter(op::shutdown&&);
+
+      covent::event_stream<int> create_event_stream(op::multishot_accept&&);
+      covent::event_stream<covent::buffer_view> create_event_stream(op::recv_multishot&&);
+      covent::event_stream<int> create_event_stream(op::poll_multishot&&);
+
+      void submit_chain(covent::detail::event_awaiter*, std::size_t, bool,
+                        std::coroutine_handle<>);
+
+      void post(covent::detail::posted_work*);
+
+      covent::detail::buffer_group_impl* create_buffer_group(unsigned, std::size_t);
+
+      int register_file(int);
+      void unregister_file(int);
+      int register_buffers(const iovec*, unsigned);
+      void unregister_buffers(int, unsigned);
+      void close_fixed(int);
   };
 
 }
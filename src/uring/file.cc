@@ -0,0 +1,157 @@
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "awaiters.hh"
+#include "evloop.hh"
+
+namespace covent::uring {
+
+  using covent::detail::event_awaiter;
+
+  awaiter_sqe_read::awaiter_sqe_read(evloop& l, op::read&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void awaiter_sqe_read::setup_sqe(io_uring_sqe* sqe) {
+    if (op.buf_index >= 0)
+      io_uring_prep_read_fixed(sqe, op.fd, op.buf, op.len, op.offset,
+                               op.buf_index);
+    else
+      io_uring_prep_read(sqe, op.fd, op.buf, op.len, op.offset);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  }
+
+
+  awaiter_sqe_write::awaiter_sqe_write(evloop& l, op::write&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void awaiter_sqe_write::setup_sqe(io_uring_sqe* sqe) {
+    if (op.buf_index >= 0)
+      io_uring_prep_write_fixed(sqe, op.fd, op.buf, op.len, op.offset,
+                                op.buf_index);
+    else
+      io_uring_prep_write(sqe, op.fd, op.buf, op.len, op.offset);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  }
+
+
+  awaiter_sqe_writev::awaiter_sqe_writev(evloop& l, op::writev&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void awaiter_sqe_writev::setup_sqe(io_uring_sqe* sqe) {
+    io_uring_prep_writev(sqe, op.fd, op.iov, op.count, op.offset);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  }
+
+
+  awaiter_sqe_openat::awaiter_sqe_openat(evloop& l, op::openat&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void awaiter_sqe_openat::setup_sqe(io_uring_sqe* sqe) {
+    io_uring_prep_openat(sqe, op.dirfd, op.path, op.flags, op.mode);
+  }
+
+  awaiter_sqe_fsync::awaiter_sqe_fsync(evloop& l, op::fsync&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void awaiter_sqe_fsync::setup_sqe(io_uring_sqe* sqe) {
+    io_uring_prep_fsync(sqe, op.fd, op.datasync ? IORING_FSYNC_DATASYNC : 0);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  }
+
+  awaiter_sqe_fallocate::awaiter_sqe_fallocate(evloop& l, op::fallocate&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void awaiter_sqe_fallocate::setup_sqe(io_uring_sqe* sqe) {
+    io_uring_prep_fallocate(sqe, op.fd, op.mode, op.offset, op.len);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  }
+
+  awaiter_sqe_statx::awaiter_sqe_statx(evloop& l, op::statx&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void awaiter_sqe_statx::setup_sqe(io_uring_sqe* sqe) {
+    io_uring_prep_statx(sqe, op.dirfd, op.path, op.flags, op.mask, op.buf);
+  }
+
+  awaiter_sqe_close::awaiter_sqe_close(evloop& l, op::close&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void awaiter_sqe_close::setup_sqe(io_uring_sqe* sqe) {
+    if (op.fixed)
+      io_uring_prep_close_direct(sqe, op.fd);
+    else
+      io_uring_prep_close(sqe, op.fd);
+  }
+
+
+  static_assert(sizeof(awaiter_sqe_read) <= event_awaiter::storage_size,
+                "awaiter_sqe_read doesn't fit the inline storage");
+  static_assert(sizeof(awaiter_sqe_write) <= event_awaiter::storage_size,
+                "awaiter_sqe_write doesn't fit the inline storage");
+
+  event_awaiter evloop::create_event_awaiter(op::read&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_read>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::write&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_write>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::writev&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_writev>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::openat&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_openat>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::fsync&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_fsync>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::fallocate&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_fallocate>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::statx&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_statx>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::close&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_close>, *this, std::move(o) };
+  }
+
+}
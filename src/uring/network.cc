@@ -1,144 +1,238 @@
-  class ostream : public iofu::obstream_base<ostream,iovec> {
-    public:
-      using iofu::obstream_base<ostream,iovec>::operator<<;
-
-      ostream(std::endian endian = std::endian::big,
-              std::size_t slab_size = 32)
-        : iofu::obstream_base<ostream,iovec>(endian, slab_size) {
-        /* empty */
-      }
+/* Copyright 2022 Florian Wagner <florian@wagner-flo.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "awaiters.hh"
+#include "evloop.hh"
+
+#include <cerrno>
+#include <unistd.h>
+
+namespace covent::uring {
+
+  using covent::buffer_view;
+  using covent::event_stream;
+  using covent::detail::event_awaiter;
+
+  awaiter_sqe_accept::awaiter_sqe_accept(evloop& l, op::accept&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
 
-      void operator||(std::function<void(void)> f) {
-        // write();
-      }
-  };
+  void awaiter_sqe_accept::setup_sqe(io_uring_sqe* sqe) {
+    io_uring_prep_accept(sqe, op.fd, nullptr, nullptr, op.flags);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  }
 
-  void loop::listen_tcp(uint16_t port, tcp_protocol::factory_t fac) {
-    int sock = socket(PF_INET, SOCK_STREAM, 0);
-    if (sock == -1)
-      throw std::runtime_error("socket()");
 
-    int enable = 1;
-    if (setsockopt(sock,
-                   SOL_SOCKET, SO_REUSEADDR,
-                   &enable, sizeof(int)) < 0)
-      throw std::runtime_error("setsockopt(SO_REUSEADDR)");
+  awaiter_sqe_connect::awaiter_sqe_connect(evloop& l, op::connect&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
 
-    sockaddr_in addr = {};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  void awaiter_sqe_connect::setup_sqe(io_uring_sqe* sqe) {
+    auto& addr = loop.args_of(slot).addr = op.addr;
+    io_uring_prep_connect(sqe, op.fd, &addr.sa, addr.len);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  }
 
-    if (bind(sock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0)
-      throw std::runtime_error("bind()");
 
-    if (listen(sock, 10) < 0)
-      throw std::runtime_error("listen()");
+  awaiter_sqe_recv::awaiter_sqe_recv(evloop& l, op::recv&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
 
-    create_resource<tcp_acceptor>(sock, fac).accept();
+  void awaiter_sqe_recv::setup_sqe(io_uring_sqe* sqe) {
+    io_uring_prep_recv(sqe, op.fd, op.buf, op.len, op.flags);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
   }
 
-  auto loop::listen_tcp(uint16_t port) {
-    return detail::callback_forward(
-      [this, port](tcp_protocol::factory_t fac) { listen_tcp(port, fac); }
-    );
+
+  void awaiter_sqe_zc::complete(res_t r, flags_t f) {
+    if (f & IORING_CQE_F_MORE) {
+      sent = r;
+      return;
+    }
+    awaiter_sqe::complete(f & IORING_CQE_F_NOTIF ? sent : r, f);
   }
 
-  class fd_resource : public resource {
-    protected:
-      int fd;
-
-    public:
-      fd_resource(loop&, int);
-  };
-
-  class tcp_connection : public fd_resource {
-    protected:
-      tcp_protocol* proto;
-
-    public:
-      tcp_connection(loop&, int, tcp_protocol::factory_t&);
-      ~tcp_connection();
-
-      void on_connect();
-
-      void write(detail::ostream);
-
-      detail::ostream write(std::endian endian = std::endian::big,
-                            std::size_t slab_size = 32);
-
-      template<typename T> detail::ostream operator<<(T);
-      // template<typename T> detail::istream operator>>(T);
-  };
-
-  class tcp_acceptor : public fd_resource {
-    protected:
-      tcp_protocol::factory_t protocol_factory;
-      sockaddr_in addr;
-      socklen_t addr_len = sizeof(addr);
-      char hbuf[NI_MAXHOST];
-      char sbuf[NI_MAXSERV];
-
-    public:
-      tcp_acceptor(loop&, int, tcp_protocol::factory_t&);
-      void on_accept(int);
-      void accept();
-  };
-
-  // template <typename P>
-  // void tcp_connection::write(std::string data, void (P::*func)()) {
-  //   auto sqe = lp.create_sqe(
-  //     // explicitly capture "data" so object doesn't go out of scope
-  //     [this, func, data] (loop&, loop::res_t, loop::flags_t) {
-  //       (reinterpret_cast<P*>(proto)->*func)();
-  //     }
-  //   );
-  //   io_uring_prep_send(
-  //     sqe, fd,
-  //     data.c_str(),
-  //     data.length(),
-  //     0
-  //   );
-  //   lp.submit();
-  // }
-
-  detail::ostream tcp_connection::write(std::endian endian,
-                                        std::size_t slab_size) {
-    return detail::ostream(
-      endian, slab_size// ,
-      // []() {
-
-      // }
-    );
+
+  awaiter_sqe_send::awaiter_sqe_send(evloop& l, op::send&& o)
+    : awaiter_sqe_zc(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void awaiter_sqe_send::setup_sqe(io_uring_sqe* sqe) {
+    if (op.buf_index >= 0)
+      io_uring_prep_send_zc_fixed(sqe, op.fd, op.buf, op.len, op.flags,
+                                  0, op.buf_index);
+    else
+      io_uring_prep_send(sqe, op.fd, op.buf, op.len, op.flags);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  }
+
+
+  awaiter_sqe_sendmsg::awaiter_sqe_sendmsg(evloop& l, op::sendmsg&& o)
+    : awaiter_sqe_zc(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void awaiter_sqe_sendmsg::setup_sqe(io_uring_sqe* sqe) {
+    if (op.zerocopy)
+      io_uring_prep_sendmsg_zc(sqe, op.fd, op.msg, op.flags);
+    else
+      io_uring_prep_sendmsg(sqe, op.fd, op.msg, op.flags);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  }
+
+  awaiter_sqe_shutdown::awaiter_sqe_shutdown(evloop& l, op::shutdown&& o)
+    : awaiter_sqe(l), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  void awaiter_sqe_shutdown::setup_sqe(io_uring_sqe* sqe) {
+    io_uring_prep_shutdown(sqe, op.fd, op.how);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+  }
+
+
+  stream_sqe_accept::stream_sqe_accept(evloop& l, op::multishot_accept&& o)
+    : stream_sqe(l, o.buffer), op(std::move(o)) {
+    /* nothing to do here */
+  }
+
+  stream_sqe_accept::~stream_sqe_accept() {
+    // close connections nobody picked up
+    while (!results.empty()) {
+      if (auto fd = results.pop(); fd >= 0) {
+        if (op.direct)
+          loop.close_fixed(fd);
+        else
+          ::close(fd);
+      }
+    }
   }
 
-  template<typename T>
-  detail::ostream tcp_connection::operator<<(T value) {
-    return write() << value;
+  void stream_sqe_accept::setup_sqe(io_uring_sqe* sqe) {
+    // fixed files have no close-on-exec flag
+    if (op.direct)
+      io_uring_prep_multishot_accept_direct(
+        sqe, op.fd, nullptr, nullptr, op.flags & ~SOCK_CLOEXEC
+      );
+    else
+      io_uring_prep_multishot_accept(sqe, op.fd, nullptr, nullptr, op.flags);
+    if (op.fixed)
+      io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
   }
 
-  tcp_acceptor::tcp_acceptor(loop& l, int f, tcp_protocol::factory_t& fac)
-    : fd_resource(l, f), protocol_factory(fac) {
-    /* empty */
+  void stream_sqe_accept::on_result(res_t r, flags_t, bool more) {
+    // the kernel may end it on its own at any time; errors are handed
+    // to the consumer and the next wait starts over
+    if (!more && r >= 0)
+      rearm();
+    push(r);
   }
 
-  void tcp_acceptor::on_accept(int fd) {
-    std::cout << "on_accept" << std::endl;
-    if (getnameinfo(reinterpret_cast<const sockaddr*>(&addr), addr_len,
-                    hbuf, NI_MAXHOST, sbuf, NI_MAXSERV,
-                    NI_NUMERICHOST | NI_NUMERICSERV) == 0)
-      std::cout << "host=" << hbuf << ", serv=" << sbuf << std::endl;
-    lp.create_resource<tcp_connection>(fd, protocol_factory).on_connect();
-    accept();
+
+  stream_sqe_recv::stream_sqe_recv(evloop& l, op::recv_multishot&& o)
+    : stream_sqe(l, o.buffer), op(std::move(o)) {
+    /* nothing to do here */
   }
 
-  void tcp_acceptor::accept() {
-    auto sqe = lp.create_sqe([this] (loop&, __s32 r, __u32) { on_accept(r); });
-    io_uring_prep_accept(
-      sqe, fd,
-      reinterpret_cast<sockaddr*>(&addr),
-      &addr_len,
-      0
+  stream_sqe_recv::~stream_sqe_recv() {
+    // the kernel may go on picking buffers until the final completion,
+    // which the loop gives back to the pinned group
+    if (slot != evloop::no_slot) {
+      auto group = static_cast<buffer_ring*>(op.group);
+      group->pin();
+      loop.args_of(slot).group = group;
+    }
+  }
+
+  void stream_sqe_recv::setup_sqe(io_uring_sqe* sqe) {
+    io_uring_prep_recv_multishot(sqe, op.fd, nullptr, 0, 0);
+    sqe->buf_group = static_cast<buffer_ring*>(op.group)->group_id();
+    io_uring_sqe_set_flags(
+      sqe, IOSQE_BUFFER_SELECT | (op.fixed ? IOSQE_FIXED_FILE : 0)
     );
-    lp.submit();
   }
+
+  void stream_sqe_recv::on_result(res_t r, flags_t f, bool more) {
+    if (r == -ENOBUFS) {
+      op.group->exhausted();
+      // with data still buffered the consumer is going to return
+      // buffers before waiting again, which starts over; otherwise it
+      // holds on to all of them and has to learn about it
+      if (!results.empty())
+        return;
+    }
+
+    // the kernel ends the multishot receive on its own when it runs out
+    // of buffers or the ring overflows; go on unless at end of stream
+    if (!more && r > 0)
+      rearm();
+
+    if (f & IORING_CQE_F_BUFFER)
+      push(buffer_view(op.group, f >> IORING_CQE_BUFFER_SHIFT, r));
+    else
+      push(buffer_view(r));
+  }
+
+
+  static_assert(sizeof(awaiter_sqe_connect) <= event_awaiter::storage_size,
+                "awaiter_sqe_connect doesn't fit the inline storage");
+  static_assert(sizeof(awaiter_sqe_send) <= event_awaiter::storage_size,
+                "awaiter_sqe_send doesn't fit the inline storage");
+  static_assert(sizeof(awaiter_sqe_sendmsg) <= event_awaiter::storage_size,
+                "awaiter_sqe_sendmsg doesn't fit the inline storage");
+
+  event_awaiter evloop::create_event_awaiter(op::accept&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_accept>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::connect&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_connect>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::recv&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_recv>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::send&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_send>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::sendmsg&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_sendmsg>, *this, std::move(o) };
+  }
+
+  event_awaiter evloop::create_event_awaiter(op::shutdown&& o) {
+    return { *this, std::in_place_type<awaiter_sqe_shutdown>, *this, std::move(o) };
+  }
+
+  event_stream<int> evloop::create_event_stream(op::multishot_accept&& o) {
+    return event_stream<int>(new stream_sqe_accept(*this, std::move(o)));
+  }
+
+  event_stream<buffer_view> evloop::create_event_stream(op::recv_multishot&& o) {
+    return event_stream<buffer_view>(new stream_sqe_recv(*this, std::move(o)));
+  }
+
+}